@@ -0,0 +1,256 @@
+/*
+ * sfx_gen synthesis benchmark
+ *
+ * Renders a fixed seed corpus of every generator, wave type & sample format
+ * and prints the timings as JSON.
+ *
+ * Compile with: cc -O2 bench.c -Isupport -lm -o sfxbench
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+// Count the allocations made by the synthesizer.
+static long allocCount = 0;
+static long allocBytes = 0;
+
+static void* countMalloc(size_t size)
+{
+    ++allocCount;
+    allocBytes += size;
+    return malloc(size);
+}
+
+#define malloc(size)    countMalloc(size)
+#include "sfx_gen.c"
+#undef malloc
+
+#include "well512.c"
+Well512 rng;
+#define SEED_RNG(S) well512_init(&rng, S)
+
+int sfx_random(int range)
+{
+    return well512_genU32(&rng) % range;
+}
+
+#define EX_USAGE    64  /* command line usage error */
+
+#define SAMPLE_RATE 44100
+#define MAX_DURATION 10
+#define CORPUS_SEED 0x5fb3
+
+#ifdef SFX_FIXED_POINT
+#define FIXED_POINT "true"
+#else
+#define FIXED_POINT "false"
+#endif
+
+typedef struct {
+    const char* name;
+    void (*func)(SfxParams*);
+} Generator;
+
+static void genRandomize(SfxParams* sp)
+{
+    sfx_genRandomize(sp, SFX_SQUARE);
+}
+
+static const Generator generators[] = {
+    {"pickupCoin", sfx_genPickupCoin},
+    {"laserShoot", sfx_genLaserShoot},
+    {"explosion",  sfx_genExplosion},
+    {"powerup",    sfx_genPowerup},
+    {"hitHurt",    sfx_genHitHurt},
+    {"jump",       sfx_genJump},
+    {"blipSelect", sfx_genBlipSelect},
+    {"synth",      sfx_genSynth},
+    {"randomize",  genRandomize}
+};
+
+#define GEN_COUNT   (int) (sizeof(generators) / sizeof(Generator))
+
+static const char* waveNames[] = {
+    "square", "sawtooth", "sine", "noise", "triangle", "pinkNoise"
+};
+
+static const char* formatNames[] = { "u8", "i16", "f32" };
+
+static double timeNow()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// FNV-1a hash of the output so that other kernels can be checked against
+// the reference.
+static uint32_t hashSamples(const SfxSynth* synth, int count)
+{
+    const uint8_t* it = synth->samples.u8;
+    const uint8_t* end;
+    uint32_t hash = 2166136261u;
+
+    if (synth->sampleFormat == SFX_I16)
+        count *= sizeof(int16_t);
+    else if (synth->sampleFormat == SFX_F32)
+        count *= sizeof(float);
+    for (end = it + count; it != end; ++it)
+        hash = (hash ^ *it) * 16777619u;
+    return hash;
+}
+
+#ifdef SFX_PROFILE
+// Append the counters of the last render to the case object.
+static void printProfile(const SfxProfile* prof)
+{
+    int i;
+
+    printf(",\n     \"profile\": {\"noiseRefills\": %u, "
+           "\"envTransitions\": %u, \"repeatResets\": %u, \"clamps\": %u,\n"
+           "      \"ticks\": {", prof->noiseRefills, prof->envTransitions,
+           prof->repeatResets, prof->clamps);
+    for (i = 0; i < SFX_PROF_COUNT; ++i)
+        printf("%s\"%s\": %llu", i ? ", " : "", sfx_profileStageName(i),
+               (unsigned long long) prof->ticks[i]);
+    printf("}}");
+}
+#endif
+
+static const char* usage =
+    "Usage: sfxbench [-h] [-n] [-c <count>] [-r <runs>] [-w <warmup>]\n"
+    "\n"
+    "Options:\n"
+    "  -c <count>   Set the synth controlRate (default 0).\n"
+    "  -h           Print this help and quit.\n"
+    "  -n           Use the fast noise generator.\n"
+    "  -r <runs>    Timed renders of each case (default 5).\n"
+    "  -w <warmup>  Untimed renders of each case (default 1).\n";
+
+int main(int argc, char** argv)
+{
+    SfxSynth* synth[3];
+    SfxParams params;
+    double* times;
+    double t0, total = 0.0;
+    long totalSamples = 0;
+    int runs = 5;
+    int warmup = 1;
+    int controlRate = 0;
+    int fastNoise = 0;
+    int g, w, f, r, count, first = 1;
+    uint32_t seed;
+
+    for (r = 1; r < argc; ++r) {
+        if (strcmp(argv[r], "-r") == 0 && r+1 < argc)
+            runs = atoi(argv[++r]);
+        else if (strcmp(argv[r], "-c") == 0 && r+1 < argc)
+            controlRate = atoi(argv[++r]);
+        else if (strcmp(argv[r], "-n") == 0)
+            fastNoise = 1;
+        else if (strcmp(argv[r], "-w") == 0 && r+1 < argc)
+            warmup = atoi(argv[++r]);
+        else {
+            fputs(usage, strcmp(argv[r], "-h") ? stderr : stdout);
+            return strcmp(argv[r], "-h") ? EX_USAGE : 0;
+        }
+    }
+    if (runs < 1)
+        runs = 1;
+
+    for (f = 0; f < 3; ++f) {
+        synth[f] = sfx_allocSynth(SFX_U8 + f, SAMPLE_RATE, MAX_DURATION);
+        synth[f]->controlRate = controlRate;
+        synth[f]->fastNoise = fastNoise;
+    }
+    times = (double*) malloc(sizeof(double) * runs);
+
+    printf("{\n  \"version\": \"%s\",\n  \"sampleRate\": %d,\n"
+           "  \"controlRate\": %d,\n  \"fixedPoint\": %s,\n"
+           "  \"fastNoise\": %s,\n"
+           "  \"runs\": %d,\n  \"warmup\": %d,\n  \"cases\": [",
+           SFX_VERSION_STR, SAMPLE_RATE, controlRate, FIXED_POINT,
+           fastNoise ? "true" : "false", runs, warmup);
+
+    for (g = 0; g < GEN_COUNT; ++g) {
+        for (w = 0; w <= SFX_PINK_NOISE; ++w) {
+            seed = CORPUS_SEED + g * 16 + w;
+            SEED_RNG(seed);
+            generators[g].func(&params);
+            params.waveType = w;
+            params.randSeed = seed;
+
+            for (f = 0; f < 3; ++f) {
+                double mean = 0.0, var = 0.0, best;
+                long allocs;
+
+                for (r = 0; r < warmup; ++r) {
+                    SEED_RNG(seed);
+                    sfx_generateWave(synth[f], &params);
+                }
+
+                allocs = allocCount;
+                allocBytes = 0;
+                for (r = 0; r < runs; ++r) {
+                    SEED_RNG(seed);
+                    t0 = timeNow();
+                    count = sfx_generateWave(synth[f], &params);
+                    times[r] = timeNow() - t0;
+                }
+                allocs = allocCount - allocs;
+
+                best = times[0];
+                for (r = 0; r < runs; ++r) {
+                    mean += times[r];
+                    if (best > times[r])
+                        best = times[r];
+                }
+                total += mean;
+                totalSamples += (long) count * runs;
+                mean /= runs;
+                for (r = 0; r < runs; ++r)
+                    var += (times[r] - mean) * (times[r] - mean);
+                if (runs > 1)
+                    var /= runs - 1;
+
+                // Variance is reported for ns/sample.
+                if (count) {
+                    mean *= 1e9 / count;
+                    best *= 1e9 / count;
+                    var  *= (1e9 / count) * (1e9 / count);
+                }
+
+                printf("%s\n    {\"generator\": \"%s\", \"wave\": \"%s\", "
+                       "\"format\": \"%s\", \"seed\": %u, \"samples\": %d,\n"
+                       "     \"nsPerSample\": %.3f, \"nsPerSampleMin\": %.3f, "
+                       "\"variance\": %.4f,\n"
+                       "     \"samplesPerSec\": %.0f, \"allocations\": %ld, "
+                       "\"allocBytes\": %ld, \"hash\": \"%08x\"",
+                       first ? "" : ",",
+                       generators[g].name, waveNames[w], formatNames[f],
+                       seed, count, mean, best, var,
+                       mean > 0.0 ? 1e9 / mean : 0.0,
+                       allocs, allocBytes, hashSamples(synth[f], count));
+#ifdef SFX_PROFILE
+                printProfile(&synth[f]->profile);
+#endif
+                putchar('}');
+                first = 0;
+            }
+        }
+    }
+
+    printf("\n  ],\n  \"total\": {\"samples\": %ld, \"seconds\": %.6f, "
+           "\"nsPerSample\": %.3f, \"samplesPerSec\": %.0f}\n}\n",
+           totalSamples, total,
+           totalSamples ? total * 1e9 / totalSamples : 0.0,
+           total > 0.0 ? totalSamples / total : 0.0);
+
+    free(times);
+    for (f = 0; f < 3; ++f)
+        free(synth[f]);
+    return 0;
+}
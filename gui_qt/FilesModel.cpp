@@ -1,12 +1,60 @@
+#include <algorithm>
+#include <atomic>
+#include <functional>
 #include <QAbstractItemModel>
 #include <QDir>
+#include <QDateTime>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QFileSystemWatcher>
+#include <QImage>
+#include <QThread>
+#include <QTimer>
 
+#define SCAN_BATCH      512     // Maximum names per scan delivery.
+#define SCAN_BATCH_MS   50      // Maximum time between scan deliveries.
+#define RESYNC_LIMIT    1000    // Changes above which the model is reset.
+
+/*
+  List of the files in a directory.  The directory is read on a worker
+  thread and rows are inserted as names arrive, then sorted once the scan
+  is complete.  Changes made to the directory afterwards are applied as
+  individual row insertions & removals.
+
+  An icon & detail text can be attached to each file.  These are requested
+  from the ExtraFunc when a view first asks for the icon of a row, and are
+  kept until the file is removed or its modification time changes.
+*/
 class FilesModel : public QAbstractItemModel
 {
 public:
 
-    FilesModel(QObject* parent = nullptr) : QAbstractItemModel(parent) {}
+    typedef std::function<void (const QString& path)> ExtraFunc;
+
+    FilesModel(QObject* parent = nullptr) : QAbstractItemModel(parent),
+        _scanGen(0), _complete(false)
+    {
+        _rescan.setSingleShot(true);
+        _rescan.setInterval(200);
+        QObject::connect(&_rescan, &QTimer::timeout, this,
+                         [this]() { startScan(true); });
+        QObject::connect(&_watcher, &QFileSystemWatcher::directoryChanged,
+                         this, [this]() { _rescan.start(); });
+    }
+
+    ~FilesModel() {
+        ++_scanGen;
+        for (QThread* th : _scanThreads) {
+            th->wait();
+            delete th;
+        }
+    }
+
     void setDirectory(const QString& path, const QString& filter = QString());
+    void setTextFilter(const QString& text);
+    void setExtraRequest(ExtraFunc func) { _requestExtra = func; }
+    void setExtra(const QString& path, const QImage& icon,
+                  const QString& detail);
 
     QString filePath(const QModelIndex& index) {
         quintptr id = index.internalId();
@@ -24,10 +72,24 @@ public:
     }
 
     QVariant data(const QModelIndex& index, int role) const {
+        quintptr id = index.internalId();
+        if (index.column() != 0 || id >= (unsigned long) _files.size())
+            return QVariant();
+
         if (role == Qt::DisplayRole) {
-            quintptr id = index.internalId();
-            if (index.column() == 0 && id < (unsigned long) _files.size())
-                return _files[id];
+            auto it = _extra.constFind(_files[id]);
+            if (it != _extra.constEnd() && ! it->detail.isEmpty())
+                return _files[id] + "  (" + it->detail + ")";
+            return _files[id];
+        }
+        if (role == Qt::DecorationRole) {
+            auto it = _extra.constFind(_files[id]);
+            if (it != _extra.constEnd())
+                return it->icon;
+            if (_requestExtra) {
+                _extra.insert(_files[id], FileExtra());  // Mark as pending.
+                _requestExtra(_directory + _files[id]);
+            }
         }
         return QVariant();
     }
@@ -52,27 +114,343 @@ public:
     //bool removeRows( int row, int count, const QModelIndex& parent );
 
 protected:
+
+    struct FileExtra
+    {
+        QImage icon;
+        QString detail;
+    };
+
+    typedef QHash<QString, qint64> TimeMap;   // Name to mtime (ms).
+
+    int findRow(const QString& name) const;
+    void dropChangedExtra(const TimeMap& times);
+
+    bool matches(const QString& name) const {
+        return _text.isEmpty() || name.contains(_text, Qt::CaseInsensitive);
+    }
+
+    void startScan(bool refresh);
+    void appendScanned(int gen, const QStringList& names,
+                       const TimeMap& times);
+    void sortScanned(int gen);
+    void syncScanned(int gen, const QStringList& names, const TimeMap& times);
+
     QString _directory;
-    QStringList _files;
+    QStringList _nameFilters;
+    QString _text;              // Filter typed by the user.
+    QStringList _all;           // Every file in the directory.
+    QStringList _files;         // Rows; the _all entries which match _text.
+    TimeMap _modified;          // Modification times of _all.
+    QFileSystemWatcher _watcher;
+    QTimer _rescan;
+    QList<QThread*> _scanThreads;
+    std::atomic<int> _scanGen;  // Incremented to cancel running scans.
+    bool _complete;             // Initial scan is done and rows are sorted.
+    ExtraFunc _requestExtra;
+    mutable QHash<QString, FileExtra> _extra;   // Keyed by file name.
 };
 
 
 void FilesModel::setDirectory(const QString& path, const QString& filter)
 {
+    QString prevDir = _directory;
+    QStringList prevFilters = _nameFilters;
+
     _directory = path;
     if (! path.isEmpty() && path.back() != QDir::separator())
         _directory.push_back(QDir::separator());
+    _nameFilters = QDir::nameFiltersFromString(filter);
 
-    QDir dir(path, filter, QDir::Name, QDir::Files);
-    QFileInfoList list = dir.entryInfoList();
-    if (list.empty() && _files.empty())
+    if (_directory == prevDir && _nameFilters == prevFilters && _complete) {
+        startScan(true);
         return;
+    }
 
-    beginResetModel();
-    _files.clear();
-    for (int i = 0; i < list.size(); ++i) {
-        _files.push_back( list.at(i).fileName() );
+    if (! _watcher.directories().empty())
+        _watcher.removePaths(_watcher.directories());
+    if (! path.isEmpty())
+        _watcher.addPath(path);
+
+    _complete = false;
+    _extra.clear();
+    _modified.clear();
+    if (! _all.empty()) {
+        beginResetModel();
+        _all.clear();
+        _files.clear();
+        endResetModel();
     }
+    startScan(false);
+}
+
+
+/*
+  Read the directory on a worker thread.  A refresh delivers the complete
+  sorted list to syncScanned(), otherwise the names are delivered in
+  batches to appendScanned().
+*/
+void FilesModel::startScan(bool refresh)
+{
+    int gen = ++_scanGen;
+    QString path = _directory;
+    QStringList filters = _nameFilters;
+
+    QThread* th = QThread::create([this, path, filters, gen, refresh]() {
+        QDirIterator it(path, filters, QDir::Files);
+        QStringList names;
+        TimeMap times;
+        QElapsedTimer timer;
+        timer.start();
+
+        while (it.hasNext()) {
+            if (_scanGen != gen)
+                return;
+            it.next();
+            names.push_back(it.fileName());
+            times.insert(it.fileName(),
+                         it.fileInfo().lastModified().toMSecsSinceEpoch());
+
+            if (! refresh && (names.size() >= SCAN_BATCH ||
+                              timer.elapsed() >= SCAN_BATCH_MS)) {
+                QMetaObject::invokeMethod(this,
+                    [this, gen, names, times]() {
+                        appendScanned(gen, names, times);
+                    }, Qt::QueuedConnection);
+                names.clear();
+                times.clear();
+                timer.restart();
+            }
+        }
+
+        if (refresh) {
+            names.sort();
+            QMetaObject::invokeMethod(this,
+                [this, gen, names, times]() {
+                    syncScanned(gen, names, times);
+                }, Qt::QueuedConnection);
+        } else {
+            QMetaObject::invokeMethod(this,
+                [this, gen, names, times]() {
+                    appendScanned(gen, names, times);
+                    sortScanned(gen);
+                }, Qt::QueuedConnection);
+        }
+    });
+
+    QObject::connect(th, &QThread::finished, this, [this, th]() {
+        _scanThreads.removeOne(th);
+        th->deleteLater();
+    });
+    _scanThreads.append(th);
+    th->start();
+}
+
+
+void FilesModel::appendScanned(int gen, const QStringList& names,
+                               const TimeMap& times)
+{
+    if (gen != _scanGen || names.empty())
+        return;
+
+    QStringList rows;
+    for (const QString& it : names) {
+        if (matches(it))
+            rows.push_back(it);
+    }
+    _all.append(names);
+    for (auto it = times.constBegin(); it != times.constEnd(); ++it)
+        _modified.insert(it.key(), it.value());
+
+    if (! rows.empty()) {
+        int first = _files.size();
+        beginInsertRows(QModelIndex(), first, first + rows.size() - 1);
+        _files.append(rows);
+        endInsertRows();
+    }
+}
+
+
+// Put the rows in name order once the initial scan is complete.
+void FilesModel::sortScanned(int gen)
+{
+    if (gen != _scanGen)
+        return;
+
+    _all.sort();
+    _complete = true;
+
+    emit layoutAboutToBeChanged();
+    QModelIndexList prevIndex = persistentIndexList();
+    QStringList prevName;
+    for (const QModelIndex& it : prevIndex)
+        prevName.push_back(_files[it.row()]);
+
+    _files.sort();
+
+    QModelIndexList newIndex;
+    for (const QString& name : prevName) {
+        auto pos = std::lower_bound(_files.begin(), _files.end(), name);
+        newIndex.push_back(index(int(pos - _files.begin()), 0, QModelIndex()));
+    }
+    changePersistentIndexList(prevIndex, newIndex);
+    emit layoutChanged();
+}
+
+
+// Apply the difference between the current and a newly read directory.
+void FilesModel::syncScanned(int gen, const QStringList& names,
+                             const TimeMap& times)
+{
+    if (gen != _scanGen)
+        return;
+
+    QStringList rows;
+    for (const QString& it : names) {
+        if (matches(it))
+            rows.push_back(it);
+    }
+    _all = names;
+    dropChangedExtra(times);
+    _modified = times;
+
+    if (! _complete) {
+        // The initial scan was interrupted so the rows are not sorted.
+        _complete = true;
+        beginResetModel();
+        _files = rows;
+        endResetModel();
+        return;
+    }
+
+    // Count the changes to see if a reset is cheaper.
+    int changes = 0;
+    int i = 0;
+    int n = 0;
+    while (i < _files.size() || n < rows.size()) {
+        if (n == rows.size() || (i < _files.size() && _files[i] < rows[n]))
+            ++i, ++changes;
+        else if (i == _files.size() || rows[n] < _files[i])
+            ++n, ++changes;
+        else
+            ++i, ++n;
+    }
+    if (! changes)
+        return;
+    if (changes > RESYNC_LIMIT) {
+        beginResetModel();
+        _files = rows;
+        endResetModel();
+        return;
+    }
+
+    i = n = 0;
+    while (i < _files.size() || n < rows.size()) {
+        if (n == rows.size() || (i < _files.size() && _files[i] < rows[n])) {
+            beginRemoveRows(QModelIndex(), i, i);
+            _files.removeAt(i);
+            endRemoveRows();
+        } else if (i == _files.size() || rows[n] < _files[i]) {
+            beginInsertRows(QModelIndex(), i, i);
+            _files.insert(i, rows[n]);
+            endInsertRows();
+            ++i, ++n;
+        } else
+            ++i, ++n;
+    }
+}
+
+
+int FilesModel::findRow(const QString& name) const
+{
+    if (_complete) {
+        auto it = std::lower_bound(_files.begin(), _files.end(), name);
+        if (it != _files.end() && *it == name)
+            return int(it - _files.begin());
+        return -1;
+    }
+    return _files.indexOf(name);
+}
+
+
+/*
+  Attach an icon & detail text to a file.  If the icon is null then the
+  request failed and may be made again.
+*/
+void FilesModel::setExtra(const QString& path, const QImage& icon,
+                          const QString& detail)
+{
+    if (! path.startsWith(_directory))
+        return;
+    QString name = path.mid(_directory.size());
+    auto it = _extra.find(name);
+    if (it == _extra.end())
+        return;     // Not requested for the current directory.
+
+    if (icon.isNull()) {
+        _extra.erase(it);
+        return;
+    }
+    it->icon = icon;
+    it->detail = detail;
+
+    int row = findRow(name);
+    if (row >= 0) {
+        QModelIndex mi = index(row, 0, QModelIndex());
+        emit dataChanged(mi, mi);
+    }
+}
+
+
+/*
+  Forget the icons of files which are not in times (removed) or whose
+  modification time differs from _modified, so that they are requested
+  again if still visible.  Must be called before _modified is updated.
+*/
+void FilesModel::dropChangedExtra(const TimeMap& times)
+{
+    auto it = _extra.begin();
+    while (it != _extra.end()) {
+        auto mt = times.constFind(it.key());
+        if (mt != times.constEnd() && *mt == _modified.value(it.key(), -1)) {
+            ++it;
+            continue;
+        }
+        bool removed = (mt == times.constEnd());
+        QString name = it.key();
+        it = _extra.erase(it);
+        if (! removed) {
+            int row = findRow(name);
+            if (row >= 0) {
+                QModelIndex mi = index(row, 0, QModelIndex());
+                emit dataChanged(mi, mi);
+            }
+        }
+    }
+}
+
+
+/*
+  Show only the files which contain text (case insensitive).  When the
+  filter is narrowed only the current rows are searched.
+*/
+void FilesModel::setTextFilter(const QString& text)
+{
+    if (text == _text)
+        return;
+
+    bool narrow = ! _text.isEmpty() &&
+                  text.contains(_text, Qt::CaseInsensitive);
+    _text = text;
+
+    QStringList rows;
+    for (const QString& it : narrow ? _files : _all) {
+        if (matches(it))
+            rows.push_back(it);
+    }
+
+    beginResetModel();
+    _files = rows;
     endResetModel();
 }
 
@@ -0,0 +1,360 @@
+/*
+  sfx_gen Qt GUI - Background sound renderer
+
+  Copyright 2023 Karl Robillard
+
+  This program may be used under the terms of the GPLv3 license
+  (see SfxWindow.cpp).
+*/
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QMutex>
+#include <QThread>
+#include <QWaitCondition>
+
+#define RENDER_BLOCK    4096
+#define PROGRESS_MS     30      // Minimum time between partial results.
+#define BUFFER_INITIAL  (RENDER_BLOCK * 8)
+#define BUFFER_SPARE    4       // Maximum recycled buffers kept.
+#define PREVIEW_AHEAD   (RENDER_BLOCK * 3)  // Rendered before playing.
+
+/*
+  Samples of a sound which are made available as they are rendered so that
+  playback can start before the render is finished.
+*/
+struct RenderPreview
+{
+    float* samples;         // Written by the renderer up to available.
+    std::atomic<int> available;
+    std::atomic<bool> done; // No more samples will be made available.
+    std::atomic<bool> ownsSamples;  // Set if the render was abandoned.
+    int readPos;            // Used only by fill().
+    bool waiting;           // Used only by fill().
+    bool streaming;         // Used only by the receiver.
+
+    RenderPreview() : samples(nullptr), available(0), done(false),
+                      ownsSamples(false), readPos(0), waiting(true),
+                      streaming(false) {}
+    ~RenderPreview() {
+        if (ownsSamples)
+            free(samples);
+    }
+
+    // The samples must be written before available is updated, and
+    // available before done, as fill() reads them in the opposite order.
+    void publish(int count, bool finished, bool abandon = false) {
+        if (abandon)
+            ownsSamples = true;
+        available.store(count, std::memory_order_release);
+        if (finished)
+            done.store(true, std::memory_order_release);
+    }
+
+    /*
+      AudStreamFunc to play the samples.  This is called by the audio thread
+      so it takes no lock and never waits.  Playback does not begin (or
+      resume after the renderer falls behind) until PREVIEW_AHEAD samples
+      are ready; silence is played until then.
+    */
+    static int fill(void* user, float* out, int frameCount) {
+        RenderPreview* pv = (RenderPreview*) user;
+        bool finished = pv->done.load(std::memory_order_acquire);
+        int ahead = pv->available.load(std::memory_order_acquire) -
+                    pv->readPos;
+        int n = 0;
+
+        if (finished || ahead >= PREVIEW_AHEAD)
+            pv->waiting = false;
+        if (! pv->waiting) {
+            n = std::min(frameCount, ahead);
+            memcpy(out, pv->samples + pv->readPos, n * sizeof(float));
+            pv->readPos += n;
+            if (finished)
+                return n;
+            if (n < frameCount)
+                pv->waiting = true;
+        }
+        memset(out + n, 0, (frameCount - n) * sizeof(float));
+        return frameCount;
+    }
+};
+
+struct RenderJob
+{
+    SfxParams params;
+    std::shared_ptr<RenderPreview> preview;     // Optional
+    uint32_t serial;        // Identifies the request to the receiver.
+    int slot;
+    bool play;
+};
+
+/*
+  If partial is true then only frameCount samples of job.preview are ready
+  and samples & peaks are null.  If samples is null in a final result then
+  the render failed as memory could not be allocated.
+*/
+struct RenderResult
+{
+    RenderJob job;
+    float* samples;         // Receiver must recycle() or free().
+    int capacity;           // Number of floats allocated for samples.
+    WavePeaks* peaks;       // Receiver must delete.
+    QImage* spectrum;       // Receiver must delete.
+    int frameCount;
+    int expectedCount;      // Length of sound if not cut short.
+    int sampleRate;
+    bool partial;
+};
+
+/*
+  Renders sounds on worker threads, each with its own synth.  Only the most
+  recent request for each slot is kept; if a newer request arrives while a
+  slot is being rendered then the render is abandoned.
+*/
+class SfxRenderer
+{
+public:
+
+    typedef std::function<void (RenderResult*)> DeliverFunc;
+
+    // The deliver function is called from the worker threads.
+    SfxRenderer(DeliverFunc func) : _deliver(func), _quit(false) {}
+
+    ~SfxRenderer() {
+        _mutex.lock();
+        _quit = true;
+        _cond.wakeAll();
+        _mutex.unlock();
+        for (QThread* th : _threads) {
+            th->wait();
+            delete th;
+        }
+        for (const SpareBuffer& it : _spare)
+            free(it.samples);
+    }
+
+    void start(int threadCount = 1,
+               QThread::Priority pri = QThread::InheritPriority) {
+        for (int i = 0; i < threadCount; ++i) {
+            QThread* th = QThread::create([this]() { run(); });
+            _threads.append(th);
+            th->start(pri);
+        }
+    }
+
+    // If a preview is given then partial results are delivered as the
+    // sound is rendered into it.
+    void request(int slot, const SfxParams& params, bool play,
+                 uint32_t serial,
+                 std::shared_ptr<RenderPreview> preview = nullptr)
+    {
+        QMutexLocker lock(&_mutex);
+        RenderJob* job = findJob(slot);
+        if (! job) {
+            _jobs.append(RenderJob());
+            job = &_jobs.last();
+        }
+        job->params = params;
+        job->preview = preview;
+        job->serial = serial;
+        job->slot = slot;
+        job->play = play;
+        _latest[slot] = serial;
+        _cond.wakeOne();
+    }
+
+    // Return a sample buffer from a RenderResult for reuse.
+    void recycle(float* samples, int capacity) {
+        if (! samples)
+            return;
+        QMutexLocker lock(&_mutex);
+        if (_spare.size() < BUFFER_SPARE)
+            _spare.append(SpareBuffer{samples, capacity});
+        else
+            free(samples);
+    }
+
+private:
+
+    struct SpareBuffer
+    {
+        float* samples;
+        int capacity;
+    };
+
+    // Get a buffer holding at least count floats or nullptr if out of memory.
+    float* takeBuffer(int count, int& capacity) {
+        float* buf = nullptr;
+        capacity = 0;
+        _mutex.lock();
+        if (! _spare.isEmpty()) {
+            SpareBuffer sb = _spare.takeLast();
+            buf = sb.samples;
+            capacity = sb.capacity;
+        }
+        _mutex.unlock();
+        if (capacity < count) {
+            float* nbuf = (float*) realloc(buf, count * sizeof(float));
+            if (! nbuf) {
+                free(buf);
+                capacity = 0;
+                return nullptr;
+            }
+            buf = nbuf;
+            capacity = count;
+        }
+        return buf;
+    }
+
+    void run() {
+        SfxSynth* synth = sfx_allocSynth(SFX_F32, 44100, 10);
+        SpectrogramBuilder spec;
+        RenderJob job;
+        RenderResult* res;
+
+        _mutex.lock();
+        while (! _quit) {
+            if (_jobs.isEmpty()) {
+                _cond.wait(&_mutex);
+                continue;
+            }
+            job = _jobs.takeFirst();
+            _mutex.unlock();
+
+            res = render(synth, spec, job);
+            if (res)
+                _deliver(res);
+
+            _mutex.lock();
+        }
+        _mutex.unlock();
+
+        free(synth);
+    }
+
+    // The caller must hold _mutex.
+    RenderJob* findJob(int slot) {
+        for (RenderJob& it : _jobs) {
+            if (it.slot == slot)
+                return &it;
+        }
+        return nullptr;
+    }
+
+    bool superseded(const RenderJob& job) {
+        QMutexLocker lock(&_mutex);
+        return _quit || _latest.value(job.slot) != job.serial;
+    }
+
+    RenderResult* newResult(SfxSynth* synth, const RenderJob& job,
+                            int count) {
+        const SfxGenState& st = synth->state;
+        int expected = st.envLength[0] + st.envLength[1] + st.envLength[2];
+        int limit = synth->sampleRate * synth->maxDuration;
+
+        RenderResult* res = new RenderResult;
+        res->job = job;
+        res->samples = nullptr;
+        res->capacity = 0;
+        res->peaks = nullptr;
+        res->spectrum = nullptr;
+        res->frameCount = count;
+        res->expectedCount = std::min(expected, limit);
+        res->sampleRate = synth->sampleRate;
+        res->partial = false;
+        return res;
+    }
+
+    /*
+      Render into a buffer which is passed to the receiver in the result.
+      The buffer grows as needed unless there is a preview, which gets a
+      buffer for the maximum length as it must not move while streaming.
+      The spectrogram columns are made as each block is finished.
+    */
+    RenderResult* render(SfxSynth* synth, SpectrogramBuilder& spec,
+                         const RenderJob& job) {
+        RenderPreview* pv = job.preview.get();
+        int limit = synth->sampleRate * synth->maxDuration;
+        float* out;
+        int capacity;
+        QElapsedTimer timer;
+        int64_t nextProgress = 0;
+        int total = 0;
+        int n;
+
+        if (pv) {
+            out = pv->samples = takeBuffer(limit, capacity);
+            timer.start();
+        } else
+            out = takeBuffer(BUFFER_INITIAL, capacity);
+        if (! out) {
+            if (pv)
+                pv->publish(0, true);
+            return newResult(synth, job, 0);
+        }
+
+        spec.reset();
+        SEED_RNG(job.params.randSeed);
+        sfx_startWave(synth, &job.params);
+        do {
+            if (total + RENDER_BLOCK > capacity && capacity < limit) {
+                int grow = std::min(std::max(capacity * 2,
+                                             total + RENDER_BLOCK), limit);
+                float* nout = (float*) realloc(out, grow * sizeof(float));
+                if (! nout) {
+                    recycle(out, capacity);
+                    return newResult(synth, job, 0);
+                }
+                out = nout;
+                capacity = grow;
+            }
+            n = sfx_generateBlock(synth, out + total,
+                                  std::min(RENDER_BLOCK, capacity - total));
+            total += n;
+            if (superseded(job)) {
+                if (pv)
+                    pv->publish(total, true, true);
+                else
+                    recycle(out, capacity);
+                return nullptr;
+            }
+            spec.update(out, total, false);
+            if (pv && n == RENDER_BLOCK) {
+                pv->publish(total, false);
+                // The receiver starts streaming on the first partial result.
+                if (total >= PREVIEW_AHEAD &&
+                    timer.elapsed() >= nextProgress) {
+                    RenderResult* res = newResult(synth, job, total);
+                    res->partial = true;
+                    _deliver(res);
+                    nextProgress = timer.elapsed() + PROGRESS_MS;
+                }
+            }
+        } while (n == RENDER_BLOCK);
+
+        if (pv)
+            pv->publish(total, true);
+        spec.update(out, total, true);
+
+        RenderResult* res = newResult(synth, job, total);
+        res->samples = out;
+        res->capacity = capacity;
+        res->peaks = new WavePeaks;
+        res->peaks->build(out, total);
+        res->spectrum = spec.image();
+        return res;
+    }
+
+    DeliverFunc _deliver;
+    QMutex _mutex;
+    QWaitCondition _cond;
+    QList<RenderJob> _jobs;
+    QHash<int, uint32_t> _latest;   // Serial of last request for each slot.
+    QList<SpareBuffer> _spare;
+    QList<QThread*> _threads;
+    bool _quit;
+};
@@ -22,18 +22,21 @@
 #include <QApplication>
 #include <QBoxLayout>
 #include <QButtonGroup>
+#include <QElapsedTimer>
 #include <QFileDialog>
 #include <QKeyEvent>
 #include <QLabel>
+#include <QLineEdit>
 #include <QListView>
 #include <QMenuBar>
 #include <QMessageBox>
-#include <QPainter>
 #include <QPushButton>
 #include <QRandomGenerator>
 #include <QSettings>
 #include <QSlider>
+#include <QSpinBox>
 #include <QStyle>
+#include <QThread>
 #include <QToolBar>
 #include <QToolButton>
 #include "SfxWindow.h"
@@ -48,15 +51,19 @@
 
 #include "FilesModel.cpp"
 
+// Each thread has its own generator as sounds are rendered in the
+// background.
 #if 1
 #include "well512.h"
-static Well512 rng;
+static thread_local Well512 rng;
 #define SEED_RNG(S) well512_init(&rng, S)
 #else
-static QRandomGenerator rng;
+static thread_local QRandomGenerator rng;
 #define SEED_RNG(S) rng.seed(S)
 #endif
 
+static QElapsedTimer startupTimer;
+
 // Random function required by sfx_gen.
 extern "C" int sfx_random(int range)
 {
@@ -67,6 +74,11 @@ extern "C" int sfx_random(int range)
 #endif
 }
 
+#include "WaveView.cpp"
+#include "Spectrogram.cpp"
+#include "Renderer.cpp"
+#include "Thumbnailer.cpp"
+
 // Audio wave data
 struct Wave
 {
@@ -75,20 +87,61 @@ struct Wave
     uint16_t sampleSize;    // Bit depth (bits per sample): 8, 16, 32
     uint16_t channels;      // Number of channels (1-mono, 2-stereo, ...)
     float*   data;          // Buffer data pointer
+    int      capacity;      // Number of floats allocated for data
+    WavePeaks* peaks;       // Display summary of data
+    QImage* spectrum;
+    int slot;               // Bank slot or -1 if unused
+    uint32_t lastUse;
+};
+
+/*
+  The slot bank keeps only the parameters of each slot.  Rendered sound
+  data & audio buffers are held by a small set of resident Waves which are
+  reassigned to the least recently used slots.
+*/
+#define SLOT_COUNT      256
+#define RESIDENT_SLOTS  8
+#define PREFETCH_BEHIND 2       // Slots before & after the active one
+#define PREFETCH_AHEAD  4       // which are rendered in advance.
+
+#define GEN_COUNT       10
+#define GEN_MUTATE      8
+#define GEN_RANDOMIZE   9
+
+// Pre-rendered next sound of a generator button.
+struct Candidate
+{
+    SfxParams params;
+    SfxParams base;         // Active slot parameters when made
+    RenderResult* result;   // Null until rendered
+    uint32_t serial;
 };
 
-#define MAX_WAVE_SLOTS  4
 struct WaveTables {
 #ifndef USE_FAUN
-    uint32_t bufId[MAX_WAVE_SLOTS];
-    int srcId[MAX_WAVE_SLOTS];
+    uint32_t bufId[RESIDENT_SLOTS];
+    int srcId[RESIDENT_SLOTS];
 #endif
-    Wave wave[MAX_WAVE_SLOTS];
-    SfxParams params[MAX_WAVE_SLOTS];
+    Wave wave[RESIDENT_SLOTS];
+    SfxParams params[SLOT_COUNT];
+    uint32_t renderSerial[SLOT_COUNT];  // Most recent render request
+    int8_t resident[SLOT_COUNT];        // Index of wave or -1
+    bool rendering[SLOT_COUNT];         // Render requested but not done
+    bool playWhenDone[SLOT_COUNT];      // Play once the render is done
+    uint32_t useCount;
+    Candidate cand[GEN_COUNT];
     SfxParams clip;
 };
 
-#define GEN_COUNT   10
+static void deleteResult(RenderResult* res)
+{
+    free(res->samples);
+    delete res->peaks;
+    delete res->spectrum;
+    delete res;
+}
+
+
 static const char* genName[] = {
     "Pickup/Coin",
     "Laser/Shoot",
@@ -251,21 +304,49 @@ SfxWindow::SfxWindow()
 
     _paramAssign = true;
     _playOnChange = true;
+    _audioReady = false;
+    _audioError = nullptr;
     _activeWav = 0;
     _recentPid = 0;
-
-    _synth = sfx_allocSynth(SFX_F32, 44100, 10);
+    _firstPaintMs = _audioReadyMs = -1;
+    _previewStream = 0;
 
     _wav = new WaveTables;
-    for (i = 0; i < MAX_WAVE_SLOTS; ++i) {
+    for (i = 0; i < RESIDENT_SLOTS; ++i) {
 #ifndef USE_FAUN
         _wav->bufId[i] = 0;
         _wav->srcId[i] = 0;
 #endif
         memset(_wav->wave + i, 0, sizeof(Wave));
+        _wav->wave[i].slot = -1;
+    }
+    for (i = 0; i < SLOT_COUNT; ++i) {
         sfx_resetParams(_wav->params + i);
+        _wav->renderSerial[i] = 0;
+        _wav->resident[i] = -1;
+        _wav->rendering[i] = false;
+        _wav->playWhenDone[i] = false;
+    }
+    _wav->useCount = 0;
+    for (i = 0; i < GEN_COUNT; ++i) {
+        _wav->cand[i].result = nullptr;
+        _wav->cand[i].serial = 0;
     }
+
+    _renderer = new SfxRenderer([this](RenderResult* res) {
+        QMetaObject::invokeMethod(this, [this, res]() { renderDone(res); },
+                                  Qt::QueuedConnection);
+    });
+    _renderer->start(std::max(1, QThread::idealThreadCount()));
+
+    _speculator = new SfxRenderer([this](RenderResult* res) {
+        QMetaObject::invokeMethod(this, [this, res]() { candidateDone(res); },
+                                  Qt::QueuedConnection);
+    });
+    _speculator->start(1, QThread::LowPriority);
     _wav->clip.waveType = -1;
+    for (i = 0; i < GEN_COUNT; ++i)
+        prepareCandidate(i);
 
     createActions();
     createMenus();
@@ -279,17 +360,40 @@ SfxWindow::SfxWindow()
     layoutParams(loH);
 
     _files = new FilesModel(this);
+    _thumbs = new Thumbnailer([this](const QString& path, const QImage& img,
+                                     int ms) {
+        QString detail;
+        if (! img.isNull())
+            detail = QString::asprintf("%d ms", ms);
+        QMetaObject::invokeMethod(this, [this, path, img, detail]() {
+            _files->setExtra(path, img, detail);
+        }, Qt::QueuedConnection);
+    });
+    _files->setExtraRequest([this](const QString& path) {
+        _thumbs->request(path);
+    });
+    QLineEdit* ffilter = new QLineEdit;
+    ffilter->setPlaceholderText("Filter");
+    ffilter->setClearButtonEnabled(true);
+    connect(ffilter, SIGNAL(textChanged(const QString&)),
+                     SLOT(filterFiles(const QString&)));
     QListView* flist = new QListView;
     flist->setUniformItemSizes(true);
+    flist->setIconSize(QSize(THUMB_W, THUMB_H));
     flist->setModel(_files);
     connect(flist, SIGNAL(activated(const QModelIndex&)),
                     SLOT(chooseFile(const QModelIndex&)));
-    loH->addWidget(flist);
+    {
+    QBoxLayout* loV = new QVBoxLayout;
+    loV->addWidget(ffilter);
+    loV->addWidget(flist);
+    loH->addLayout(loV);
+    }
 
-    _wavePix = QPixmap(640, 58);
-    _wavePic = new QLabel;
-    _wavePic->setPixmap(_wavePix);
-    lo->addWidget(_wavePic, 0, Qt::AlignHCenter);
+    _waveView = new WaveView;
+    lo->addWidget(_waveView);
+    _specView = new SpectrogramView;
+    lo->addWidget(_specView);
 
     loH = new QHBoxLayout;
     lo->addLayout(loH);
@@ -308,21 +412,19 @@ SfxWindow::SfxWindow()
     _actPoc->setChecked(settings.value("play-on-change", true).toBool());
     }
 
+    // Opening the audio device can block for some time so it is done in
+    // the background.  Sounds played before audioStarted() are queued.
+    _audioThread = QThread::create([this]() {
 #ifdef USE_FAUN
-    const char* error =
-        faun_startup(MAX_WAVE_SLOTS, MAX_WAVE_SLOTS, 0, 0, APP_NAME);
-    if (error) {
-        QString msg("faun_startup: ");
-        msg.append(error);
-        QMessageBox::critical(this, "Audio System", msg);
-    }
+        _audioError =
+            faun_startup(RESIDENT_SLOTS, RESIDENT_SLOTS, 0, 0, APP_NAME);
 #else
-    if (aud_startup()) {
-        aud_genBuffers(MAX_WAVE_SLOTS, _wav->bufId);
-    } else {
-        QMessageBox::critical(this, "Audio System", "aud_startup() failed!\n");
-    }
+        if (! aud_startup())
+            _audioError = "aud_startup() failed!\n";
 #endif
+    });
+    connect(_audioThread, SIGNAL(finished()), SLOT(audioStarted()));
+    _audioThread->start();
 
     _param[0]->setValue(vol);
     updateParameterWidgets(_wav->params);
@@ -333,18 +435,33 @@ SfxWindow::SfxWindow()
 
 SfxWindow::~SfxWindow()
 {
+    _audioThread->wait();
+    delete _audioThread;
+
 #ifdef USE_FAUN
     faun_shutdown();
 #else
-    aud_stopAll();
-    aud_freeBuffers(MAX_WAVE_SLOTS, _wav->bufId);
+    if (_audioReady) {
+        aud_stopAll();
+        aud_freeBuffers(RESIDENT_SLOTS, _wav->bufId);
+    }
     aud_shutdown();
 #endif
 
-    free(_synth);
+    delete _renderer;
+    delete _speculator;
+    for (int i = 0; i < GEN_COUNT; ++i) {
+        if (_wav->cand[i].result)
+            deleteResult(_wav->cand[i].result);
+    }
+    _files->setExtraRequest(nullptr);
+    delete _thumbs;
 
-    for (int i = 0; i < MAX_WAVE_SLOTS; ++i)
+    for (int i = 0; i < RESIDENT_SLOTS; ++i) {
         free(_wav->wave[i].data);
+        delete _wav->wave[i].peaks;
+        delete _wav->wave[i].spectrum;
+    }
     delete _wav;
 }
 
@@ -359,10 +476,62 @@ void SfxWindow::closeEvent( QCloseEvent* ev )
     QMainWindow::closeEvent( ev );
 }
 
+bool SfxWindow::event( QEvent* ev )
+{
+    if (ev->type() == QEvent::Paint && _firstPaintMs < 0)
+        _firstPaintMs = int(startupTimer.elapsed());
+    return QMainWindow::event( ev );
+}
+
 void SfxWindow::showAbout()
 {
+    QString startup = QString::asprintf("\n\nStartup: first paint %d ms, "
+                                        "audio ready %d ms",
+                                        _firstPaintMs, _audioReadyMs);
+
     QMessageBox::information( this, "About " APP_NAME,
-        "Version " APP_VERSION "\n\nCopyright (c) 2022,2023 Karl Robillard" );
+        "Version " APP_VERSION "\n\nCopyright (c) 2022,2023 Karl Robillard"
+        + startup );
+}
+
+
+// Called in the GUI thread once the audio device startup has finished.
+void SfxWindow::audioStarted()
+{
+    _audioReadyMs = int(startupTimer.elapsed());
+
+    if (_audioError) {
+#ifdef USE_FAUN
+        QString msg("faun_startup: ");
+        msg.append(_audioError);
+        QMessageBox::critical(this, "Audio System", msg);
+#else
+        QMessageBox::critical(this, "Audio System", _audioError);
+#endif
+        _pendingPlay.clear();
+        return;
+    }
+
+#ifndef USE_FAUN
+    aud_genBuffers(RESIDENT_SLOTS, _wav->bufId);
+#endif
+    _audioReady = true;
+
+    float fv = float(_param[PARAM_VOL]->value()) * 0.01f;
+#ifdef USE_FAUN
+    faun_setParameter(0, RESIDENT_SLOTS, FAUN_VOLUME, fv);
+#else
+    aud_setSoundVolume(fv);
+#endif
+
+    for (int i = 0; i < RESIDENT_SLOTS; ++i) {
+        if (_wav->wave[i].data)
+            loadAudioBuffer(i);
+    }
+
+    for (int slot : _pendingPlay)
+        playSlot(slot);
+    _pendingPlay.clear();
 }
 
 
@@ -448,21 +617,20 @@ void SfxWindow::createTools()
 
     _tools->addWidget(new QLabel("  Slot:"));
 
-    QButtonGroup* grp = new QButtonGroup(this);
-    for (int i = 0; i < MAX_WAVE_SLOTS; ++i) {
-        btn = new QToolButton;
-        btn->setText(QString::number(i+1));
-        btn->setCheckable(true);
-        grp->addButton(btn, i);
-        _tools->addWidget(btn);
+    _slotSpin = new QSpinBox;
+    _slotSpin->setRange(1, SLOT_COUNT);
+    _slotSpin->setSuffix(QString(" / %1").arg(SLOT_COUNT));
+    _slotSpin->setKeyboardTracking(false);
+    _tools->addWidget(_slotSpin);
+    connect(_slotSpin, SIGNAL(valueChanged(int)), SLOT(chooseWaveSlot(int)));
 
+    for (int i = 0; i < 9; ++i) {
         act = new QAction(this);
         act->setShortcut(QKeySequence(Qt::CTRL | (Qt::Key_1 + i)));
-        connect(act, SIGNAL(triggered(bool)), btn, SLOT(click()));
+        connect(act, &QAction::triggered, this,
+                [this, i]() { _slotSpin->setValue(i + 1); });
         addAction(act);
     }
-    grp->button(0)->setChecked(true);
-    connect(grp, SIGNAL(idToggled(int,bool)), SLOT(chooseWaveSlot(int,bool)));
 }
 
 
@@ -487,6 +655,7 @@ bool SfxWindow::open(const QString& file, bool updateList)
         setProjectFile(file);
         updateParameterWidgets(sp);
         regenerate(false);
+        prefetchSlots();
 
         if (updateList) {
             QFileInfo info(file);
@@ -499,13 +668,42 @@ bool SfxWindow::open(const QString& file, bool updateList)
 
 void SfxWindow::open()
 {
-    QString fn;
     QString path(_prevProjPath);
 
-    fn = QFileDialog::getOpenFileName(this, "Open Parameters", path,
-                                      "Parameters (*.rfx *.sfs)");
-    if (! fn.isEmpty())
-        open(fn, true);
+    QStringList files = QFileDialog::getOpenFileNames(this,
+                            "Open Parameters", path,
+                            "Parameters (*.rfx *.sfs)");
+    if (! files.empty())
+        openFiles(files);
+}
+
+
+/*
+  Load files into consecutive slots starting with the active one.  The
+  slots which can be held in memory are all rendered in parallel; the rest
+  will be rendered when selected.
+*/
+void SfxWindow::openFiles(const QStringList& files)
+{
+    int slot = _activeWav + 1;
+    for (int i = 1; i < files.size() && slot < SLOT_COUNT; ++i, ++slot) {
+        const char* err = sfx_loadParams(_wav->params + slot,
+                                         UTF8(files[i]), NULL);
+        if (err) {
+            QMessageBox::warning(this, "Load Error", files[i] + ":\n" + err);
+            sfx_resetParams(_wav->params + slot);
+        }
+        if (i < RESIDENT_SLOTS)
+            renderSlot(slot, false);
+        else
+            releaseSlot(slot);
+    }
+
+    if (files.empty()) {
+        regenerate(false);
+        prefetchSlots();
+    } else
+        open(files[0], true);
 }
 
 
@@ -564,7 +762,9 @@ void SfxWindow::saveAs()
                                       "Parameters (*.rfx);;Wave (*.wav)");
     if (! fn.isEmpty()) {
         if (fn.endsWith(".wav", Qt::CaseInsensitive)) {
-            saveWaveFile(_wav->wave + _activeWav, fn);
+            const Wave* wdat = residentWave(_activeWav);
+            if (wdat)
+                saveWaveFile(wdat, fn);
         } else {
             if (saveRfx(fn)) {
                 setProjectFile(fn);
@@ -601,70 +801,151 @@ void SfxWindow::setPoc(bool on)
 }
 
 
-void SfxWindow::playSound()
+void SfxWindow::playSlot(int slot)
 {
+    int i = _wav->resident[slot];
+    if (i < 0) {
+        // The sound data was released; render it again.
+        renderSlot(slot, true);
+        return;
+    }
+    _wav->wave[i].lastUse = ++_wav->useCount;
+
+    if (! _audioReady) {
+        // Queue the request until the audio device is open.
+        if (! _audioError && ! _pendingPlay.contains(slot))
+            _pendingPlay.append(slot);
+        return;
+    }
+
 #ifdef USE_FAUN
-    faun_playSource(_activeWav, _activeWav, FAUN_PLAY_ONCE);
+    faun_playSource(i, i, FAUN_PLAY_ONCE);
 #else
-    int i = _activeWav;
+    stopPreview();
     _wav->srcId[i] = aud_playSound(_wav->bufId[i]);
 #endif
 }
 
 
-void SfxWindow::generateSound()
+void SfxWindow::playSound()
 {
-    int gid = sender()->property("gid").toInt();
-    if (gid < 0)
-        return;
-
-    if (gid < GEN_COUNT-2) {
-        SfxParams* sp = _wav->params + _activeWav;
+    playSlot(_activeWav);
+}
 
-        uint32_t seed = QRandomGenerator::global()->generate();
-        SEED_RNG(seed);
-        switch (gid) {
-            case 0: sfx_genPickupCoin(sp);  break;
-            case 1: sfx_genLaserShoot(sp);  break;
-            case 2: sfx_genExplosion(sp);   break;
-            case 3: sfx_genPowerup(sp);     break;
-            case 4: sfx_genHitHurt(sp);     break;
-            case 5: sfx_genJump(sp);        break;
-            case 6: sfx_genBlipSelect(sp);  break;
-            case 7: sfx_genSynth(sp);       break;
-        }
-        sp->randSeed = seed;
 
-        updateParameterWidgets(sp);
-        regenerate(true);
-    }
-    else if (gid == 8)
-        mutate();
-    else if (gid == 9)
-        randomize();
+void SfxWindow::generateSound()
+{
+    int gid = sender()->property("gid").toInt();
+    if (gid >= 0 && gid < GEN_COUNT)
+        applyCandidate(gid);
 }
 
 
 void SfxWindow::mutate()
 {
-    SfxParams* sp = _wav->params + _activeWav;
-    sfx_mutate(sp, 0.1f, 0xffffdf);
-    updateParameterWidgets(sp);
-    regenerate(true);
+    applyCandidate(GEN_MUTATE);
 }
 
 
 void SfxWindow::randomize()
 {
-    SfxParams* sp = _wav->params + _activeWav;
+    applyCandidate(GEN_RANDOMIZE);
+}
 
-    uint32_t seed = QRandomGenerator::global()->generate();
+
+/*
+  Set parameters for a generator button.  The result depends only on the
+  seed (and the base parameters for GEN_MUTATE).
+*/
+static void generateParams(int gid, uint32_t seed, const SfxParams* base,
+                           SfxParams* sp)
+{
     SEED_RNG(seed);
-    sfx_genRandomize(sp, sfx_random(4));
+    switch (gid) {
+        case 0: sfx_genPickupCoin(sp);  break;
+        case 1: sfx_genLaserShoot(sp);  break;
+        case 2: sfx_genExplosion(sp);   break;
+        case 3: sfx_genPowerup(sp);     break;
+        case 4: sfx_genHitHurt(sp);     break;
+        case 5: sfx_genJump(sp);        break;
+        case 6: sfx_genBlipSelect(sp);  break;
+        case 7: sfx_genSynth(sp);       break;
+        case GEN_MUTATE:
+            *sp = *base;
+            sfx_mutate(sp, 0.1f, 0xffffdf);
+            return;                     // Keep the randSeed of base.
+        case GEN_RANDOMIZE:
+            sfx_genRandomize(sp, sfx_random(4));
+            break;
+    }
     sp->randSeed = seed;
+}
+
+
+/*
+  Choose the next sound for a generator button and render it in the
+  background so that it can be played as soon as the button is pressed.
+*/
+void SfxWindow::prepareCandidate(int gid)
+{
+    Candidate* cand = _wav->cand + gid;
+    if (cand->result) {
+        deleteResult(cand->result);
+        cand->result = nullptr;
+    }
+    cand->base = _wav->params[_activeWav];
+    generateParams(gid, QRandomGenerator::global()->generate(), &cand->base,
+                   &cand->params);
+    _speculator->request(gid, cand->params, false, ++cand->serial);
+}
+
+
+void SfxWindow::candidateDone(RenderResult* res)
+{
+    Candidate* cand = _wav->cand + res->job.slot;
+    if (res->job.serial != cand->serial || ! res->samples) {
+        deleteResult(res);
+        return;
+    }
+    if (cand->result)
+        deleteResult(cand->result);
+    cand->result = res;
+}
+
+
+/*
+  Assign the prepared sound of a generator button to the active slot and
+  play it.  If the candidate is not rendered yet its parameters are still
+  used so that the sequence of sounds for a button does not depend on
+  timing.
+*/
+void SfxWindow::applyCandidate(int gid)
+{
+    Candidate* cand = _wav->cand + gid;
+    SfxParams* sp = _wav->params + _activeWav;
+    RenderResult* res = cand->result;
+
+    if (gid == GEN_MUTATE && memcmp(&cand->base, sp, sizeof(SfxParams))) {
+        // The active sound changed since the candidate was made.
+        if (res)
+            deleteResult(res);
+        res = nullptr;
+        generateParams(gid, QRandomGenerator::global()->generate(), sp, sp);
+    } else {
+        *sp = cand->params;
+    }
+    cand->result = nullptr;
 
     updateParameterWidgets(sp);
-    regenerate(true);
+    if (res) {
+        res->job.slot = _activeWav;
+        res->job.serial = ++_wav->renderSerial[_activeWav];
+        res->job.play = true;
+        renderDone(res);
+    } else
+        regenerate(true);
+
+    prepareCandidate(gid);
 }
 
 
@@ -692,116 +973,278 @@ void SfxWindow::updateParameterWidgets(const SfxParams* sp)
 }
 
 
-static void drawWave(QPixmap* pix, const Wave* wave)
+void SfxWindow::updateStats(const Wave* wdat)
 {
-    int width = pix->width();
-    int halfH = pix->height() / 2;
-    int sy0, sy1, sy2;
-    float samplePos = 0.0f;
-    float sampleInc = float(wave->frameCount * wave->channels) / float(width);
-    float sampleLast = float(wave->frameCount - 1);
-    float oneThirdInc = sampleInc / 3.0f;
-    float twoThirdInc = 2.0f * oneThirdInc;
-    float sampleScale = float(halfH);
-    const float* wdata = (const float*) wave->data;
+    _waveView->setWave(wdat->data, wdat->frameCount, wdat->peaks);
+    _specView->setImage(wdat->spectrum);
 
-    pix->fill(QColor(0,0x22,0x2b));
+    _stats[0]->setText(QString::asprintf("Frames: %d", wdat->frameCount));
+    _stats[1]->setText(QString::asprintf("Duration: %d ms",
+                                wdat->frameCount * 1000 / wdat->sampleRate));
+    _stats[2]->setText(QString::asprintf("Size: %d bytes", wdat->frameCount*2));
+}
 
-    QPainter p(pix);
-    p.setPen(QColor(255,165,60,100));
 
-#define SAMPLE_Y(pos)   halfH + int(wdata[int(pos)] * sampleScale)
+// Request that the active slot be rendered again.
+void SfxWindow::regenerate(bool play)
+{
+    renderSlot(_activeWav, play);
+}
 
-    sy0 = SAMPLE_Y(0);
 
-    for (int x = 0; x < width; x++) {
-        sy1 = SAMPLE_Y(samplePos + oneThirdInc);
-        sy2 = SAMPLE_Y(samplePos + twoThirdInc);
+// Request that a slot be rendered.  The work is done in the background and
+// renderDone() updates the slot.  When playing, the sound is streamed from
+// a preview as it is rendered.
+void SfxWindow::renderSlot(int slot, bool play)
+{
+    std::shared_ptr<RenderPreview> pv;
+#ifndef USE_FAUN
+    if (play && _audioReady)
+        pv = std::make_shared<RenderPreview>();
+#endif
+    _wav->rendering[slot] = true;
+    _renderer->request(slot, _wav->params[slot], play,
+                       ++_wav->renderSerial[slot], pv);
+}
 
-        p.drawLine(x, sy0, x, sy1);
-        p.drawLine(x, sy1, x, sy2);
 
-        samplePos += sampleInc;
-        if (samplePos > sampleLast)
-            samplePos = sampleLast;
+// Return the rendered sound of a slot or nullptr if it is not resident.
+Wave* SfxWindow::residentWave(int slot)
+{
+    int i = _wav->resident[slot];
+    return (i < 0) ? nullptr : _wav->wave + i;
+}
+
 
-        sy0 = SAMPLE_Y(samplePos);
-        p.drawLine(x, sy2, x, sy0);
+/*
+  Return the index of the Wave holding the sound of a slot.  If the slot is
+  not resident then the least recently used Wave is reassigned to it.  The
+  Wave of the active slot is never taken.
+*/
+int SfxWindow::makeResident(int slot)
+{
+    int i = _wav->resident[slot];
+    if (i >= 0)
+        return i;
+
+    Wave* wdat;
+    int oldest = -1;
+    for (i = 0; i < RESIDENT_SLOTS; ++i) {
+        wdat = _wav->wave + i;
+        if (wdat->slot < 0) {
+            oldest = i;
+            break;
+        }
+        if (wdat->slot != _activeWav &&
+            (oldest < 0 || wdat->lastUse < _wav->wave[oldest].lastUse))
+            oldest = i;
     }
 
-    p.setPen(QColor(0x81,0xa0,0xb0, 0x90));
-    p.drawLine(0, halfH, width-1, halfH);
+    wdat = _wav->wave + oldest;
+    if (wdat->slot >= 0)
+        releaseSlot(wdat->slot);
+    wdat->slot = slot;
+    _wav->resident[slot] = oldest;
+    return oldest;
 }
 
 
-void SfxWindow::updateStats(const Wave* wdat)
+// Free the sound data of a slot so that only its parameters are kept.
+void SfxWindow::releaseSlot(int slot)
 {
-    drawWave(&_wavePix, wdat);
-    _wavePic->setPixmap(_wavePix);
+    int i = _wav->resident[slot];
+    if (i < 0)
+        return;
 
-    _stats[0]->setText(QString::asprintf("Frames: %d", wdat->frameCount));
-    _stats[1]->setText(QString::asprintf("Duration: %d ms",
-                                wdat->frameCount * 1000 / wdat->sampleRate));
-    _stats[2]->setText(QString::asprintf("Size: %d bytes", wdat->frameCount*2));
+    Wave* wdat = _wav->wave + i;
+    _wav->resident[slot] = -1;
+    _pendingPlay.removeAll(slot);
+    releaseSamples(wdat);
+    delete wdat->peaks;
+    delete wdat->spectrum;
+    wdat->peaks = nullptr;
+    wdat->spectrum = nullptr;
+    wdat->frameCount = 0;
+    wdat->slot = -1;
 }
 
 
-// Update audio buffer.
-void SfxWindow::regenerate(bool play)
+/*
+  Render the slots next to the active one which are not resident so that
+  switching to them only needs to play & redraw.  These are worked on in
+  parallel by the renderer threads.
+*/
+void SfxWindow::prefetchSlots()
 {
-    int i = _activeWav;
-    Wave* wdat = _wav->wave + i;
+    int end = std::min(_activeWav + PREFETCH_AHEAD, SLOT_COUNT - 1);
+    int i;
+    for (int s = std::max(_activeWav - PREFETCH_BEHIND, 0); s <= end; ++s) {
+        if (s == _activeWav || _wav->rendering[s])
+            continue;
+        i = _wav->resident[s];
+        if (i < 0)
+            renderSlot(s, false);
+        else
+            _wav->wave[i].lastUse = ++_wav->useCount;
+    }
+}
+
+
+void SfxWindow::stopPreview()
+{
+#ifndef USE_FAUN
+    if (_previewStream) {
+        aud_stopStream(_previewStream);
+        _previewStream = 0;
+    }
+#endif
+}
+
+
+// Start streaming a preview on the first partial result and show what has
+// been rendered so far.
+void SfxWindow::renderProgress(RenderResult* res)
+{
+    RenderPreview* pv = res->job.preview.get();
+#ifndef USE_FAUN
+    if (! pv->streaming && _audioReady) {
+        stopPreview();
+        _previewStream = aud_startStream(RenderPreview::fill, pv, 0,
+                                         res->sampleRate);
+        pv->streaming = (_previewStream != 0);
+    }
+#endif
+    // Keep the preview alive as _waveView references the samples.
+    bool restart = (_preview != res->job.preview);
+    _preview = res->job.preview;
+
+    if (res->job.slot == _activeWav)
+        _waveView->setPartialWave(pv->samples, res->frameCount,
+                                  res->expectedCount, restart);
+}
+
+
+// Recycle the sample buffer of a Wave unless a preview is playing it.
+void SfxWindow::releaseSamples(Wave* wdat)
+{
+    if (! wdat->data)
+        return;
+    if (_preview && _preview->samples == wdat->data)
+        _preview->ownsSamples = true;
+    else
+        _renderer->recycle(wdat->data, wdat->capacity);
+    wdat->data = nullptr;
+    wdat->capacity = 0;
+}
+
+
+// Update slot wave & audio buffer with a rendered sound.
+void SfxWindow::renderDone(RenderResult* res)
+{
+    int i = res->job.slot;
+    if (res->job.serial != _wav->renderSerial[i]) {
+        // Parameters have changed since this was requested.
+        RenderPreview* pv = res->job.preview.get();
+        if (pv && pv->samples == res->samples)
+            pv->ownsSamples = true;
+        else
+            _renderer->recycle(res->samples, res->capacity);
+        res->samples = nullptr;
+        deleteResult(res);
+        return;
+    }
 
-    int scount = sfx_generateWave(_synth, _wav->params + i);
+    if (res->partial) {
+        renderProgress(res);
+        delete res;
+        return;
+    }
+    _wav->rendering[i] = false;
+    bool play = res->job.play || _wav->playWhenDone[i];
+    _wav->playWhenDone[i] = false;
 
-    // Copy sample data to Wave struct.
-    size_t bytes = scount * sizeof(float);
-    if (uint32_t(scount) > wdat->frameCount) {
-        free(wdat->data);
-        wdat->data = (float*) malloc(bytes);
+    if (! res->samples) {
+        // Out of memory; the slot keeps its previous sound.
+        deleteResult(res);
+        return;
     }
-    memcpy(wdat->data, _synth->samples.f, bytes);
 
-    wdat->frameCount = scount;
-    wdat->sampleRate = _synth->sampleRate;
+    int slot = i;
+    i = makeResident(slot);
+    Wave* wdat = _wav->wave + i;
+    wdat->lastUse = ++_wav->useCount;
+    releaseSamples(wdat);
+    delete wdat->peaks;
+    delete wdat->spectrum;
+    wdat->data       = res->samples;
+    wdat->capacity   = res->capacity;
+    wdat->peaks      = res->peaks;
+    wdat->spectrum   = res->spectrum;
+    wdat->frameCount = res->frameCount;
+    wdat->sampleRate = res->sampleRate;
     wdat->sampleSize = 32;
     wdat->channels   = 1;
 
-    // Copy sample data to audio system.
+    if (_audioReady)
+        loadAudioBuffer(i);
+    if (play && ! (res->job.preview && res->job.preview->streaming))
+        playSlot(slot);
+
+    if (slot == _activeWav) {
+        updateStats(wdat);
+
+        // Mutate candidates are based on the active sound.
+        if (memcmp(&_wav->cand[GEN_MUTATE].base, _wav->params + slot,
+                   sizeof(SfxParams)))
+            prepareCandidate(GEN_MUTATE);
+    }
+    delete res;
+}
+
+
+// Copy sample data of resident Wave i to audio system.
+void SfxWindow::loadAudioBuffer(int i)
+{
+    const Wave* wdat = _wav->wave + i;
 #ifdef USE_FAUN
     faun_loadBufferPcm(i, FAUN_FMT_F32 | FAUN_FMT_MONO | FAUN_FMT_44100,
-                       _synth->samples.f, scount);
-    if (play)
-        faun_playSource(i, i, FAUN_PLAY_ONCE);
+                       wdat->data, wdat->frameCount);
 #else
     if (_wav->srcId[i]) {
         // Must stop all as multiple sources may be attached to our buffer.
-        aud_stopAll();
+        // Any preview stream is left to finish.
+        aud_stopSounds();
     }
-    aud_loadBufferF32(_wav->bufId[i], _synth->samples.f, scount, 0,
-                      _synth->sampleRate);
-    if (play)
-        _wav->srcId[i] = aud_playSound(_wav->bufId[i]);
+    aud_loadBufferF32(_wav->bufId[i], wdat->data, wdat->frameCount, 0,
+                      wdat->sampleRate);
 #endif
-
-    updateStats(wdat);
 }
 
 
-void SfxWindow::chooseWaveSlot(int i, bool checked)
+// Select a slot by number (1 to SLOT_COUNT).
+void SfxWindow::chooseWaveSlot(int num)
 {
-    if (checked) {
-        _activeWav = i & 3;
+    _activeWav = num - 1;
 
-        updateParameterWidgets(_wav->params + _activeWav);
+    updateParameterWidgets(_wav->params + _activeWav);
 
-        const Wave* wave = _wav->wave + _activeWav;
-        if (wave->data) {
-            playSound();
-            updateStats(wave);
-        } else
+    const Wave* wave = residentWave(_activeWav);
+    if (wave && wave->data) {
+        playSound();
+        updateStats(wave);
+    } else {
+        // Views must not reference data of a slot which may be released.
+        _waveView->setWave(nullptr, 0, nullptr);
+        _specView->setImage(nullptr);
+
+        // A pending render (such as a prefetch) always has the current
+        // parameters, so wait for it rather than starting again.
+        if (_wav->rendering[_activeWav])
+            _wav->playWhenDone[_activeWav] = true;
+        else
             regenerate(true);
     }
+    prefetchSlots();
 }
 
 
@@ -828,15 +1271,23 @@ void SfxWindow::chooseFile(const QModelIndex& mi)
 }
 
 
+void SfxWindow::filterFiles(const QString& text)
+{
+    _files->setTextFilter(text);
+}
+
+
 void SfxWindow::volumeChanged(int value)
 {
     float fv = float(value) * 0.01f;
     _paramReadout[PARAM_VOL]->setText(QString::number(fv, 'f', 2));
+    if (_audioReady) {
 #ifdef USE_FAUN
-    faun_setParameter(0, MAX_WAVE_SLOTS, FAUN_VOLUME, fv);
+        faun_setParameter(0, RESIDENT_SLOTS, FAUN_VOLUME, fv);
 #else
-    aud_setSoundVolume(fv);
+        aud_setSoundVolume(fv);
 #endif
+    }
     if (_playOnChange)
         playSound();
 }
@@ -865,6 +1316,8 @@ void SfxWindow::paramChanged(int value)
 
 int main( int argc, char **argv )
 {
+    startupTimer.start();
+
     QApplication app( argc, argv );
     app.setOrganizationName( APP_NAME );
     app.setApplicationName( APP_NAME );
@@ -872,10 +1325,10 @@ int main( int argc, char **argv )
     SfxWindow w;
     w.show();
 
-    if( argc > 1 )
-        w.open(argv[1], true);
-    else
-        w.regenerate(false);
+    QStringList files;
+    for (int i = 1; i < argc; ++i)
+        files.append(QString::fromLocal8Bit(argv[i]));
+    w.openFiles(files);
 
     return app.exec();
 }
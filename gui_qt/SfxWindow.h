@@ -10,21 +10,29 @@
 */
 
 
+#include <memory>
 #include <QMainWindow>
 
 #define PARAM_VOL   0
 #define PARAM_COUNT 23
 
+struct RenderPreview;
+struct RenderResult;
 struct SfxParams;
-struct SfxSynth;
 struct Wave;
 struct WaveTables;
 class FilesModel;
+class SfxRenderer;
+class SpectrogramView;
+class Thumbnailer;
+class WaveView;
 class QBoxLayout;
 class QGridLayout;
 class QLabel;
 class QPushButton;
 class QSlider;
+class QSpinBox;
+class QThread;
 
 class SfxWindow : public QMainWindow
 {
@@ -35,6 +43,7 @@ public:
     SfxWindow();
     ~SfxWindow();
     bool open(const QString& file, bool updateList);
+    void openFiles(const QStringList& files);
 
 public slots:
 
@@ -44,6 +53,7 @@ public slots:
 protected:
 
     virtual void closeEvent( QCloseEvent* );
+    virtual bool event( QEvent* );
 
 private slots:
 
@@ -58,11 +68,13 @@ private slots:
     void generateSound();
     void mutate();
     void randomize();
-    void chooseWaveSlot(int, bool checked);
+    void chooseWaveSlot(int num);
     void chooseWaveForm(int, bool checked);
     void chooseFile(const QModelIndex&);
+    void filterFiles(const QString&);
     void volumeChanged(int);
     void paramChanged(int);
+    void audioStarted();
 
 private:
 
@@ -77,6 +89,20 @@ private:
     void setProjectFile(const QString&);
     bool saveWaveFile(const Wave*, const QString&);
     bool saveRfx(const QString&);
+    void renderDone(RenderResult*);
+    void renderProgress(RenderResult*);
+    void stopPreview();
+    void renderSlot(int slot, bool play);
+    void prepareCandidate(int gid);
+    void candidateDone(RenderResult*);
+    void applyCandidate(int gid);
+    Wave* residentWave(int slot);
+    int  makeResident(int slot);
+    void releaseSlot(int slot);
+    void releaseSamples(Wave*);
+    void prefetchSlots();
+    void loadAudioBuffer(int wave);
+    void playSlot(int slot);
 
     QAction* _actOpen;
     QAction* _actSave;
@@ -86,21 +112,32 @@ private:
     QAction* _actPoc;
 
     QToolBar* _tools;
+    QSpinBox* _slotSpin;
     QPushButton* _waveType[6];
     QSlider* _param[PARAM_COUNT];
     QLabel*  _paramReadout[PARAM_COUNT];
-    QLabel*  _wavePic;
-    QPixmap  _wavePix;
+    WaveView* _waveView;
+    SpectrogramView* _specView;
     QLabel*  _stats[3];
     FilesModel* _files;
+    Thumbnailer* _thumbs;
 
     QString _prevProjPath;
-    SfxSynth* _synth;
+    SfxRenderer* _renderer;
+    SfxRenderer* _speculator;   // Renders generator candidates.
     WaveTables* _wav;
+    QThread* _audioThread;
+    const char* _audioError;
+    QList<int> _pendingPlay;    // Slots to play once audio is ready.
+    std::shared_ptr<RenderPreview> _preview;    // Most recent preview.
+    uint32_t _previewStream;
     int _activeWav;
     int _recentPid;
+    int _firstPaintMs;
+    int _audioReadyMs;
     bool _paramAssign;
     bool _playOnChange;
+    bool _audioReady;
 
     // Disabled copy constructor and operator=
     SfxWindow( const SfxWindow & ) : QMainWindow( 0 ) {}
@@ -0,0 +1,217 @@
+/*
+  sfx_gen Qt GUI - Spectrogram
+
+  Copyright 2023 Karl Robillard
+
+  This program may be used under the terms of the GPLv3 license
+  (see SfxWindow.cpp).
+*/
+
+#include <cmath>
+#include <vector>
+#include <QImage>
+#include <QPainter>
+#include <QWidget>
+
+#define FFT_BITS        9
+#define FFT_SIZE        (1 << FFT_BITS)
+#define SPEC_HOP        (FFT_SIZE / 2)
+#define SPEC_BINS       (FFT_SIZE / 2)
+#define SPEC_FLOOR_DB   -90.0f
+
+/*
+  Radix-2 complex FFT of FFT_SIZE points.  The tables are built once by the
+  constructor so a single instance can be reused for every frame.
+*/
+class FFT
+{
+public:
+
+    FFT() {
+        constexpr double PI = 3.14159265358979323846;
+        for (int i = 0; i < FFT_SIZE; ++i) {
+            int r = 0;
+            for (int b = 0; b < FFT_BITS; ++b)
+                r |= ((i >> b) & 1) << (FFT_BITS - 1 - b);
+            _reverse[i] = r;
+            _window[i] = 0.5f - 0.5f * std::cos(2.0 * PI * i / FFT_SIZE);
+        }
+        for (int i = 0; i < FFT_SIZE / 2; ++i) {
+            _cos[i] = float(std::cos(2.0 * PI * i / FFT_SIZE));
+            _sin[i] = float(-std::sin(2.0 * PI * i / FFT_SIZE));
+        }
+    }
+
+    // Window count samples (zero padded to FFT_SIZE) and transform them.
+    void forward(const float* samples, int count) {
+        int i;
+        for (i = 0; i < FFT_SIZE; ++i) {
+            int r = _reverse[i];
+            _re[r] = (i < count) ? samples[i] * _window[i] : 0.0f;
+            _im[r] = 0.0f;
+        }
+
+        for (int half = 1; half < FFT_SIZE; half *= 2) {
+            int step = FFT_SIZE / (half * 2);
+            for (int start = 0; start < FFT_SIZE; start += half * 2) {
+                for (int k = 0; k < half; ++k) {
+                    float wr = _cos[k * step];
+                    float wi = _sin[k * step];
+                    int a = start + k;
+                    int b = a + half;
+                    float tr = _re[b] * wr - _im[b] * wi;
+                    float ti = _re[b] * wi + _im[b] * wr;
+                    _re[b] = _re[a] - tr;
+                    _im[b] = _im[a] - ti;
+                    _re[a] += tr;
+                    _im[a] += ti;
+                }
+            }
+        }
+    }
+
+    // Return power of bin i.
+    float power(int i) const {
+        return _re[i] * _re[i] + _im[i] * _im[i];
+    }
+
+private:
+
+    float _re[FFT_SIZE];
+    float _im[FFT_SIZE];
+    float _window[FFT_SIZE];
+    float _cos[FFT_SIZE / 2];
+    float _sin[FFT_SIZE / 2];
+    int _reverse[FFT_SIZE];
+};
+
+
+static QRgb spectrumColor(float level)
+{
+    // Black - blue - red - yellow - white.
+    static const int ramp[5][3] = {
+        {0, 0x22, 0x2b}, {40, 40, 200}, {220, 30, 60}, {255, 200, 40},
+        {255, 255, 255}
+    };
+    float pos = level * 4.0f;
+    int i = std::min(int(pos), 3);
+    float t = pos - i;
+    return qRgb(int(ramp[i][0] + (ramp[i+1][0] - ramp[i][0]) * t),
+                int(ramp[i][1] + (ramp[i+1][1] - ramp[i][1]) * t),
+                int(ramp[i][2] + (ramp[i+1][2] - ramp[i][2]) * t));
+}
+
+
+/*
+  Builds a spectrogram image with a column for every SPEC_HOP samples and a
+  row for each frequency bin (highest at the top).  The columns are made as
+  the samples are rendered, once each has its full window of FFT_SIZE
+  samples, so the image is ready as soon as the render ends.  The storage
+  is kept between sounds.
+*/
+class SpectrogramBuilder
+{
+public:
+
+    SpectrogramBuilder() : _columns(0) {
+        for (int i = 0; i < 256; ++i)
+            _palette[i] = spectrumColor(i / 255.0f);
+    }
+
+    void reset() {
+        _levels.clear();
+        _columns = 0;
+    }
+
+    // Make the columns which are complete in the first count samples.  If
+    // finished is true then count is the length of the sound and the last
+    // columns are zero padded.
+    void update(const float* samples, int count, bool finished) {
+        int end;
+        if (finished)
+            end = (count + SPEC_HOP - 1) / SPEC_HOP;
+        else
+            end = (count < FFT_SIZE) ? 0 : (count - FFT_SIZE) / SPEC_HOP + 1;
+        if (end <= _columns)
+            return;
+
+        // A full scale sine has a peak of FFT_SIZE/4 with the Hann window.
+        const float ref = 1.0f / ((FFT_SIZE / 4) * (FFT_SIZE / 4));
+        const float dbScale = 255.0f / -SPEC_FLOOR_DB;
+
+        _levels.resize(end * SPEC_BINS);
+        uint8_t* lp = _levels.data() + _columns * SPEC_BINS;
+        for (; _columns < end; ++_columns) {
+            int start = _columns * SPEC_HOP;
+            _fft.forward(samples + start, std::min(FFT_SIZE, count - start));
+
+            for (int y = 0; y < SPEC_BINS; ++y) {
+                float db = 10.0f * std::log10(_fft.power(y) * ref + 1e-12f);
+                int level = int((db - SPEC_FLOOR_DB) * dbScale);
+                if (level < 0)
+                    level = 0;
+                else if (level > 255)
+                    level = 255;
+                *lp++ = level;
+            }
+        }
+    }
+
+    // Return image allocated with new or nullptr if there are no columns.
+    QImage* image() const {
+        if (! _columns)
+            return nullptr;
+        QImage* img = new QImage(_columns, SPEC_BINS, QImage::Format_RGB32);
+        const uint8_t* lp = _levels.data();
+        for (int x = 0; x < _columns; ++x) {
+            for (int y = 0; y < SPEC_BINS; ++y)
+                ((QRgb*) img->scanLine(SPEC_BINS - 1 - y))[x] =
+                    _palette[*lp++];
+        }
+        return img;
+    }
+
+private:
+
+    FFT _fft;
+    std::vector<uint8_t> _levels;   // SPEC_BINS for each column.
+    int _columns;
+    QRgb _palette[256];
+};
+
+
+/*
+  Shows a spectrogram image stretched to the widget size.
+*/
+class SpectrogramView : public QWidget
+{
+public:
+
+    SpectrogramView(QWidget* parent = nullptr) : QWidget(parent),
+        _image(nullptr)
+    {
+        setMinimumSize(640, 96);
+        setSizePolicy(QSizePolicy::Expanding, QSizePolicy::Fixed);
+        setAttribute(Qt::WA_OpaquePaintEvent);
+    }
+
+    // The image must remain valid until the next setImage() call.
+    void setImage(const QImage* image) {
+        _image = image;
+        update();
+    }
+
+protected:
+
+    void paintEvent(QPaintEvent*) {
+        QPainter p(this);
+        if (_image)
+            p.drawImage(rect(), *_image);
+        else
+            p.fillRect(rect(), QColor(0, 0x22, 0x2b));
+    }
+
+private:
+
+    const QImage* _image;
+};
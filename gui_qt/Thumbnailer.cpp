@@ -0,0 +1,221 @@
+/*
+  sfx_gen Qt GUI - Sound file thumbnails
+
+  Copyright 2023 Karl Robillard
+
+  This program may be used under the terms of the GPLv3 license
+  (see SfxWindow.cpp).
+*/
+
+#include <QCache>
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QImage>
+#include <QRunnable>
+#include <QStandardPaths>
+#include <QThreadPool>
+
+#define THUMB_W         64
+#define THUMB_H         16
+#define THUMB_QUEUE     256     // Maximum pending requests.
+#define THUMB_MEM_CACHE 4096    // Maximum thumbnails held in memory.
+
+/*
+  Renders small waveform images of sound files on a pool of threads.
+  Results are cached in memory and on disk, keyed by a hash of the file
+  contents.  The most recent requests are served first, as those are the
+  rows currently in view.  Files which fail are not tried again until they
+  are modified.
+*/
+class Thumbnailer
+{
+public:
+
+    // The deliver function is called from a pool thread.  If the image is
+    // null then the request was dropped or failed.
+    typedef std::function<void (const QString& path, const QImage& image,
+                                int durationMs)> DeliverFunc;
+
+    Thumbnailer(DeliverFunc func) : _deliver(func), _running(0),
+                                    _quit(false)
+    {
+        _memCache.setMaxCost(THUMB_MEM_CACHE);
+        _diskDir = QStandardPaths::writableLocation(
+                        QStandardPaths::CacheLocation) + "/thumbnails/";
+        QDir().mkpath(_diskDir);
+        _pool.setMaxThreadCount(std::max(1, QThread::idealThreadCount() - 1));
+    }
+
+    ~Thumbnailer() {
+        _mutex.lock();
+        _quit = true;
+        _queue.clear();
+        _mutex.unlock();
+        _pool.waitForDone();
+    }
+
+    void request(const QString& path);
+
+private:
+
+    struct Thumb
+    {
+        QImage image;
+        int durationMs;
+    };
+
+    class Task : public QRunnable
+    {
+    public:
+        Task(Thumbnailer* owner) : _owner(owner) {}
+        void run() { _owner->serviceQueue(); }
+    private:
+        Thumbnailer* _owner;
+    };
+
+    void serviceQueue();
+    bool makeThumb(SfxSynth*, const QString& path, Thumb& thumb);
+
+    DeliverFunc _deliver;
+    QThreadPool _pool;
+    QMutex _mutex;                  // Guards all but _pool & _diskDir.
+    QStringList _queue;
+    QCache<QByteArray, Thumb> _memCache;
+    QHash<QString, QDateTime> _failed;  // Modification time of bad files.
+    QString _diskDir;
+    int _running;
+    bool _quit;
+};
+
+
+void Thumbnailer::request(const QString& path)
+{
+    QString dropped;
+    bool startTask = false;
+
+    _mutex.lock();
+    auto it = _failed.constFind(path);
+    if (it != _failed.constEnd() &&
+        *it == QFileInfo(path).lastModified()) {
+        _mutex.unlock();
+        return;
+    }
+    _queue.removeOne(path);
+    _queue.append(path);
+    if (_queue.size() > THUMB_QUEUE)
+        dropped = _queue.takeFirst();
+    if (_running < _pool.maxThreadCount()) {
+        ++_running;
+        startTask = true;
+    }
+    _mutex.unlock();
+
+    if (! dropped.isEmpty())
+        _deliver(dropped, QImage(), 0);
+    if (startTask)
+        _pool.start(new Task(this));
+}
+
+
+void Thumbnailer::serviceQueue()
+{
+    SfxSynth* synth = sfx_allocSynth(SFX_F32, 44100, 10);
+    QString path;
+    QDateTime mtime;
+    Thumb thumb;
+
+    for (;;) {
+        _mutex.lock();
+        if (_quit || _queue.empty()) {
+            --_running;
+            _mutex.unlock();
+            break;
+        }
+        path = _queue.takeLast();
+        _mutex.unlock();
+
+        // Get the time first so a change made while working is not missed.
+        mtime = QFileInfo(path).lastModified();
+        if (makeThumb(synth, path, thumb))
+            _deliver(path, thumb.image, thumb.durationMs);
+        else {
+            _mutex.lock();
+            _failed.insert(path, mtime);
+            _mutex.unlock();
+            _deliver(path, QImage(), 0);
+        }
+    }
+
+    free(synth);
+}
+
+
+bool Thumbnailer::makeThumb(SfxSynth* synth, const QString& path,
+                            Thumb& thumb)
+{
+    QFile file(path);
+    if (! file.open(QIODevice::ReadOnly))
+        return false;
+    QByteArray key = QCryptographicHash::hash(file.readAll(),
+                                        QCryptographicHash::Sha1).toHex();
+    file.close();
+
+    _mutex.lock();
+    Thumb* cached = _memCache.object(key);
+    if (cached)
+        thumb = *cached;
+    _mutex.unlock();
+    if (cached)
+        return true;
+
+    QString diskFile = _diskDir + key + ".png";
+    if (thumb.image.load(diskFile) && thumb.image.width() == THUMB_W &&
+        thumb.image.height() == THUMB_H) {
+        thumb.durationMs = thumb.image.text("Duration").toInt();
+    } else {
+        SfxParams params;
+        if (sfx_loadParams(&params, QFile::encodeName(path).constData(),
+                           NULL))
+            return false;
+
+        SEED_RNG(params.randSeed);
+        int count = sfx_generateWave(synth, &params);
+        const float* samples = synth->samples.f;
+
+        QImage img(THUMB_W, THUMB_H, QImage::Format_ARGB32_Premultiplied);
+        img.fill(Qt::transparent);
+
+        const QRgb waveColor = qRgb(255, 165, 60);
+        int halfH = THUMB_H / 2;
+        for (int x = 0; x < THUMB_W && count; ++x) {
+            int s0 = x * count / THUMB_W;
+            int s1 = std::max(s0 + 1, (x + 1) * count / THUMB_W);
+            float lo = samples[s0];
+            float hi = lo;
+            for (int i = s0 + 1; i < s1; ++i) {
+                if (lo > samples[i])
+                    lo = samples[i];
+                if (hi < samples[i])
+                    hi = samples[i];
+            }
+            int y0 = std::max(0, halfH + int(lo * halfH));
+            int y1 = std::min(THUMB_H - 1, halfH + int(hi * halfH));
+            for (int y = y0; y <= y1; ++y)
+                img.setPixel(x, y, waveColor);
+        }
+
+        thumb.image = img;
+        thumb.durationMs = count * 1000 / synth->sampleRate;
+        thumb.image.setText("Duration", QString::number(thumb.durationMs));
+        thumb.image.save(diskFile, "PNG");
+    }
+
+    _mutex.lock();
+    _memCache.insert(key, new Thumb(thumb));
+    _mutex.unlock();
+    return true;
+}
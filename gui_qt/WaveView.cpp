@@ -0,0 +1,323 @@
+/*
+  sfx_gen Qt GUI - Waveform view
+
+  Copyright 2023 Karl Robillard
+
+  This program may be used under the terms of the GPLv3 license
+  (see SfxWindow.cpp).
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <QImage>
+#include <QMouseEvent>
+#include <QPainter>
+#include <QVector>
+#include <QWheelEvent>
+#include <QWidget>
+
+#if QT_VERSION >= 0x060000
+#define EVENT_X(ev)     int(ev->position().x())
+#else
+#define EVENT_X(ev)     ev->x()
+#endif
+
+#define PEAK_BASE   16      // Samples per bucket at pyramid level 0.
+
+/*
+  Multi-resolution minimum/maximum sample values.  Each level holds
+  min,max pairs for buckets of PEAK_BASE << level samples.
+*/
+struct WavePeaks
+{
+    QVector< QVector<float> > levels;
+    int count;              // Number of samples covered.
+
+    WavePeaks() : count(0) {}
+    void build(const float* samples, int count);
+    void extend(const float* samples, int count);
+    void range(int level, int first, int last, float& lo, float& hi) const;
+};
+
+void WavePeaks::build(const float* samples, int count)
+{
+    levels.clear();
+    this->count = 0;
+    extend(samples, count);
+}
+
+/*
+  Add samples to the end of those already covered.  The samples before
+  the previous count must not have changed.  Only the buckets holding the
+  new samples are computed so a growing wave can be extended as it is
+  rendered.
+*/
+void WavePeaks::extend(const float* samples, int count)
+{
+    int buckets = (count + PEAK_BASE - 1) / PEAK_BASE;
+    int first = this->count / PEAK_BASE;    // Last bucket may be partial.
+    int i, n, end;
+    float lo, hi, v;
+
+    if (count <= this->count)
+        return;
+    this->count = count;
+
+    if (levels.isEmpty())
+        levels.append(QVector<float>());
+    QVector<float>& lev = levels[0];
+    lev.resize(buckets * 2);
+    for (i = first; i < buckets; ++i) {
+        n = i * PEAK_BASE;
+        end = std::min(n + PEAK_BASE, count);
+        lo = hi = samples[n];
+        for (++n; n < end; ++n) {
+            v = samples[n];
+            if (lo > v)
+                lo = v;
+            if (hi < v)
+                hi = v;
+        }
+        lev[i*2]   = lo;
+        lev[i*2+1] = hi;
+    }
+
+    // Each higher level merges pairs of buckets from the one below.
+    for (int level = 1; buckets > 1; ++level) {
+        if (level == levels.size())
+            levels.append(QVector<float>());
+        const QVector<float>& prev = levels[level - 1];
+        QVector<float>& up = levels[level];
+        int prevBuckets = buckets;
+        buckets = (buckets + 1) / 2;
+        first = std::min(first / 2, up.size() / 2);
+        up.resize(buckets * 2);
+        for (i = first; i < buckets; ++i) {
+            n = i * 4;
+            lo = prev[n];
+            hi = prev[n+1];
+            if (i*2 + 1 < prevBuckets) {
+                lo = std::min(lo, prev[n+2]);
+                hi = std::max(hi, prev[n+3]);
+            }
+            up[i*2]   = lo;
+            up[i*2+1] = hi;
+        }
+    }
+}
+
+// Get the min & max of buckets first to last (inclusive) of a level.
+void WavePeaks::range(int level, int first, int last,
+                      float& lo, float& hi) const
+{
+    const QVector<float>& lev = levels[level];
+    const float* it  = lev.constData() + first * 2;
+    const float* end = lev.constData() + (last + 1) * 2;
+    for (; it != end; it += 2) {
+        if (lo > it[0])
+            lo = it[0];
+        if (hi < it[1])
+            hi = it[1];
+    }
+}
+
+
+/*
+  Draws a wave using the WavePeaks so that the time taken depends only on
+  the widget width.  The mouse wheel zooms, dragging pans and a double
+  click shows the entire wave.
+*/
+class WaveView : public QWidget
+{
+public:
+
+    WaveView(QWidget* parent = nullptr) : QWidget(parent),
+        _samples(nullptr), _count(0), _length(0), _peaks(nullptr),
+        _spp(1.0), _offset(0.0), _fit(true), _dragX(0)
+    {
+        setMinimumSize(640, 58);
+        setSizePolicy(QSizePolicy::Expanding, QSizePolicy::Fixed);
+        setAttribute(Qt::WA_OpaquePaintEvent);
+    }
+
+    // Set the wave to display.  The data must remain valid until the next
+    // setWave() call.  For a partially rendered wave the final length can
+    // be passed so that the view does not rescale as it grows.
+    void setWave(const float* samples, int count, const WavePeaks* peaks,
+                 int length = 0) {
+        _samples = samples;
+        _count = count;
+        _length = std::max(count, length);
+        _peaks = peaks;
+        if (_fit)
+            fitWave();
+        else
+            clampOffset();
+        update();
+    }
+
+    // Set a wave which is still being rendered.  The view keeps its own
+    // peaks and extends them as the count grows.  Restart must be true for
+    // the first call with a new wave as the buffer address may be reused.
+    void setPartialWave(const float* samples, int count, int length,
+                        bool restart) {
+        if (restart || _peaks != &_partialPeaks || samples != _samples)
+            _partialPeaks.build(samples, count);
+        else
+            _partialPeaks.extend(samples, count);
+        setWave(samples, count, &_partialPeaks, length);
+    }
+
+protected:
+
+    void paintEvent(QPaintEvent*) {
+        if (_image.size() != size())
+            _image = QImage(size(), QImage::Format_RGB32);
+        if (_fit)
+            fitWave();
+        drawImage();
+
+        QPainter p(this);
+        p.drawImage(0, 0, _image);
+        p.setPen(QColor(0x81,0xa0,0xb0, 0x90));
+        p.drawLine(0, height()/2, width()-1, height()/2);
+    }
+
+    void wheelEvent(QWheelEvent* ev) {
+        int steps = ev->angleDelta().y() / 120;
+        if (! steps || ! _count)
+            return;
+#if QT_VERSION >= 0x050e00
+        double x = ev->position().x();
+#else
+        double x = ev->pos().x();
+#endif
+        double anchor = _offset + x * _spp;
+        double spp = _spp * std::pow(0.8, steps);
+        double maxSpp = double(_length) / width();
+        if (spp < 0.125)
+            spp = 0.125;
+        if (spp >= maxSpp) {
+            _fit = true;
+            fitWave();
+        } else {
+            _fit = false;
+            _spp = spp;
+            _offset = anchor - x * _spp;
+            clampOffset();
+        }
+        update();
+    }
+
+    void mousePressEvent(QMouseEvent* ev) {
+        _dragX = EVENT_X(ev);
+    }
+
+    void mouseMoveEvent(QMouseEvent* ev) {
+        if (! _fit && (ev->buttons() & Qt::LeftButton)) {
+            _offset -= (EVENT_X(ev) - _dragX) * _spp;
+            _dragX = EVENT_X(ev);
+            clampOffset();
+            update();
+        }
+    }
+
+    void mouseDoubleClickEvent(QMouseEvent*) {
+        _fit = true;
+        update();
+    }
+
+private:
+
+    void fitWave() {
+        _offset = 0.0;
+        _spp = (_length > 0) ? double(_length) / width() : 1.0;
+    }
+
+    void clampOffset() {
+        double maxOffset = _length - width() * _spp;
+        if (_offset > maxOffset)
+            _offset = maxOffset;
+        if (_offset < 0.0)
+            _offset = 0.0;
+    }
+
+    void drawImage();
+
+    QImage _image;
+    const float* _samples;
+    int _count;
+    int _length;            // Expected count.
+    const WavePeaks* _peaks;
+    WavePeaks _partialPeaks;
+    double _spp;            // Samples per pixel.
+    double _offset;         // Sample at left edge.
+    bool _fit;
+    int _dragX;
+};
+
+// Fill column pixels from the image rows of y0 to y1 (inclusive).
+#define FILL_SPAN(y0, y1) \
+    for (int y = y0; y <= y1; ++y) \
+        ((QRgb*) (bits + y * stride))[x] = waveColor
+
+void WaveView::drawImage()
+{
+    const QRgb bgColor   = qRgb(0, 0x22, 0x2b);
+    const QRgb waveColor = qRgb(0x64, 0x55, 0x3e);   // 40% orange over bg
+    int w = _image.width();
+    int h = _image.height();
+    int halfH = h / 2;
+    uchar* bits = _image.bits();
+    int stride = _image.bytesPerLine();
+
+    _image.fill(bgColor);
+    if (! _count || ! _samples)
+        return;
+
+    // Choose the pyramid level with buckets no larger than a pixel.
+    int level = -1;
+    int bucket = 1;
+    if (_peaks && _spp >= PEAK_BASE) {
+        level = int(std::log2(_spp / PEAK_BASE));
+        if (level >= _peaks->levels.size())
+            level = _peaks->levels.size() - 1;
+        bucket = PEAK_BASE << level;
+    }
+
+    float scale = float(halfH);
+    float lo, hi;
+    int s0, s1, y0, y1;
+
+    for (int x = 0; x < w; ++x) {
+        s0 = int(_offset + x * _spp);
+        if (s0 >= _count)
+            break;
+        s1 = int(_offset + (x + 1) * _spp);     // Include first of next.
+        if (s1 >= _count)
+            s1 = _count - 1;
+        if (s1 < s0)
+            s1 = s0;
+
+        lo = hi = _samples[s0];
+        if (level < 0) {
+            for (int i = s0 + 1; i <= s1; ++i) {
+                float v = _samples[i];
+                if (lo > v)
+                    lo = v;
+                if (hi < v)
+                    hi = v;
+            }
+        } else {
+            _peaks->range(level, s0 / bucket, s1 / bucket, lo, hi);
+        }
+
+        y0 = halfH + int(lo * scale);
+        y1 = halfH + int(hi * scale);
+        if (y0 < 0)
+            y0 = 0;
+        if (y1 >= h)
+            y1 = h - 1;
+        FILL_SPAN(y0, y1);
+    }
+}
@@ -8,7 +8,7 @@
 #include <stdio.h>
 #include <time.h>
 
-#define SINGLE_FORMAT 2
+#define SINGLE_FORMAT 3
 #include "sfx_gen.c"
 #include "saveWave.c"
 
@@ -51,6 +51,106 @@ void copyPathExt(char* dest, const char* src, const char* ext)
     *dest = '\0';
 }
 
+#ifdef SFX_PROFILE
+void printProfile(const char* name, const SfxProfile* prof)
+{
+    uint64_t total = 0;
+    int i;
+
+    for (i = 0; i < SFX_PROF_COUNT; ++i)
+        total += prof->ticks[i];
+    if (! total)
+        total = 1;
+
+    fprintf(stderr, "%s: %u samples, %u noise refills, %u envelope stages,"
+            " %u repeats, %u clamps\n", name, prof->samples,
+            prof->noiseRefills, prof->envTransitions, prof->repeatResets,
+            prof->clamps);
+    for (i = 0; i < SFX_PROF_COUNT; ++i)
+        fprintf(stderr, "  %-10s %12llu %5.1f%%\n", sfx_profileStageName(i),
+                (unsigned long long) prof->ticks[i],
+                prof->ticks[i] * 100.0 / total);
+}
+#endif
+
+enum NormalizeMode {
+    NORM_NONE,
+    NORM_PEAK,
+    NORM_RMS
+};
+
+/*
+ * Remove the trimmed quiet tail from the RMS of the stats so that it covers
+ * only the trimCount samples which will be saved.
+ */
+void trimStatsRms(SfxStats* st, const float* samples)
+{
+    double sumSq = (double) st->rms * st->rms * st->sampleCount;
+    int i;
+
+    if (st->trimCount >= st->sampleCount)
+        return;
+    for (i = st->trimCount; i < st->sampleCount; ++i)
+        sumSq -= samples[i] * samples[i];
+    st->rms = (st->trimCount && sumSq > 0.0) ?
+                (float) sqrt(sumSq / st->trimCount) : 0.0f;
+}
+
+/*
+ * Return the gain which brings the sound to the target level (in dBFS).
+ * The gain is limited so that the peak does not exceed full scale.
+ */
+float normalizeGain(const SfxStats* st, int mode, float targetDb)
+{
+    float target = powf(10.0f, targetDb / 20.0f);
+    // The synth has already clamped the samples to full scale.
+    float peak = (st->peak > 1.0f) ? 1.0f : st->peak;
+    float level = (mode == NORM_PEAK) ? peak : st->rms;
+    float gain;
+
+    if (mode == NORM_NONE || level <= 0.0f)
+        return 1.0f;
+    gain = target / level;
+    if (peak * gain > 1.0f)
+        gain = 1.0f / peak;
+    return gain;
+}
+
+// Convert float samples to int16_t in place, applying gain.
+void convertI16(void* buf, int count, float gain)
+{
+    const float* src = (const float*) buf;
+    int16_t* dst = (int16_t*) buf;
+    const float* end = src + count;
+    float v;
+
+    for (; src != end; ++src) {
+        v = *src * gain;
+        if (v > 1.0f)
+            v = 1.0f;
+        else if (v < -1.0f)
+            v = -1.0f;
+        *dst++ = (int16_t) (v*32767.0f);
+    }
+}
+
+void usage(const char* prog)
+{
+    printf("Usage: %s [<options>] <param-file> [-o <wave-file>] ...\n\n"
+           "Options:\n"
+           "  -c <count>  Update slides & sweeps every count samples (faster,"
+           " but not\n"
+           "              identical to the reference).\n"
+           "  -n          Use the fast noise generator (noise differs from"
+           " the reference).\n"
+           "  -p <dBFS>   Normalize the peak of each sound to a level.\n"
+           "  -r <dBFS>   Normalize the RMS of each sound to a level (limited"
+           " by the peak).\n"
+           "  -t <dBFS>   Trim trailing samples below a level.\n"
+           "  -w <ms>     Length of quiet which ends a sound when trimming"
+           " (default 50).\n", prog);
+}
+
 int main(int argc, char** argv)
 {
     SfxSynth* synth;
@@ -59,19 +159,52 @@ int main(int argc, char** argv)
     const char* paramFile;
     const char* wavFile;
     const char* err;
+    SfxStats stats;
+    float normDb = 0.0f;
+    float trimDb = 0.0f;
+    int trimMs = 50;
+    int normMode = NORM_NONE;
+    int trim = 0;
+    int controlRate = 0;
+    int fastNoise = 0;
     int i, scount;
 
 
-    if (argc < 2) {
-        printf("Usage: %s <param-file> [-o <wave-file>] ...\n", argv[0]);
+    for (i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-p") == 0 || strcmp(argv[i], "-r") == 0) {
+            normMode = (argv[i][1] == 'p') ? NORM_PEAK : NORM_RMS;
+            if (++i == argc)
+                break;
+            normDb = (float) atof(argv[i]);
+        } else if (strcmp(argv[i], "-t") == 0 && i+1 < argc) {
+            trim = 1;
+            trimDb = (float) atof(argv[++i]);
+        } else if (strcmp(argv[i], "-c") == 0 && i+1 < argc) {
+            controlRate = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-n") == 0) {
+            fastNoise = 1;
+        } else if (strcmp(argv[i], "-w") == 0 && i+1 < argc) {
+            trimMs = atoi(argv[++i]);
+        } else
+            break;
+    }
+    if (i >= argc) {
+        usage(argv[0]);
         return EX_USAGE;
     }
 
     SEED_RNG(time(NULL));
-    synth = sfx_allocSynth(SFX_I16, 44100, 10);
+    synth = sfx_allocSynth(SFX_F32, 44100, 10);
+    if (controlRate > 0)
+        synth->controlRate = controlRate;
+    synth->fastNoise = fastNoise;
+    if (trim && trimMs > 0) {
+        synth->silenceLevel = powf(10.0f, trimDb / 20.0f);
+        synth->silenceWindow = synth->sampleRate * trimMs / 1000;
+    }
     pathBuf = malloc(1024);
 
-    for (i = 1; i < argc; ++i) {
+    for (; i < argc; ++i) {
         // Load Parameters.
         paramFile = argv[i];
         err = sfx_loadParams(&wp, paramFile, NULL);
@@ -83,7 +216,18 @@ int main(int argc, char** argv)
         // Generate Sound.
         if (wp.randSeed)
             SEED_RNG(wp.randSeed);
-        scount = sfx_generateWave(synth, &wp);
+        if (normMode) {
+            scount = sfx_generateWaveStats(synth, &wp, &stats);
+            trimStatsRms(&stats, synth->samples.f);
+            convertI16(synth->samples.f, scount,
+                       normalizeGain(&stats, normMode, normDb));
+        } else {
+            scount = sfx_generateWave(synth, &wp);
+            convertI16(synth->samples.f, scount, 1.0f);
+        }
+#ifdef SFX_PROFILE
+        printProfile(paramFile, &synth->profile);
+#endif
 
         // Save as WAVE.
         if (i+1 < argc && strcmp(argv[i+1], "-o") == 0) {
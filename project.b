@@ -1,5 +1,5 @@
 options [
-    audio-api: 'faun    "Audio interface ('faun or 'openal)"
+    audio-api: 'faun    "Audio interface ('faun, 'openal or 'null)"
 ]
 
 default [
@@ -20,12 +20,20 @@ exe %qfxgen [
         cflags "-DUSE_FAUN"
         libs %faun
     ][
-        sources [
-            %support/audio_openal.c
+        either eq? audio-api 'null [
+            sources [
+                %support/audio_null.c
+            ]
+            unix  [libs %pthread]
+            win32 [libs %pthread]
+        ][
+            sources [
+                %support/audio_openal.c
+            ]
+            linux [libs %openal libs %pthread]
+            macx  [lflags "-framework OpenAL"]
+            win32 [libs %OpenAL32.dll libs %pthread]
         ]
-        linux [libs %openal]
-        macx  [lflags "-framework OpenAL"]
-        win32 [libs %OpenAL32.dll]
     ]
 ]
 
@@ -34,3 +42,22 @@ exe %sfxgen [
     sources [%main.c]
     unix [libs %m]
 ]
+
+exe %sfxbench [
+    console
+    sources [%bench.c]
+    unix [libs %m]
+]
+
+exe %sfxcmp [
+    console
+    sources [%test/sfxcmp.c]
+    unix [libs %m]
+]
+
+exe %audcheck [
+    console
+    sources [%test/audcheck.c %support/audio_null.c]
+    unix  [libs %pthread]
+    win32 [libs %pthread]
+]
@@ -8,7 +8,7 @@ CONFIG += qt
 #CONFIG += debug
 
 INCLUDEPATH += gui_qt support
-LIBS += -lopenal
+LIBS += -lopenal -lpthread
 
 HEADERS += gui_qt/SfxWindow.h sfx_gen.h
 SOURCES += gui_qt/SfxWindow.cpp sfx_gen.c
@@ -32,6 +32,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 // This function provided by the user returns an integer between
 // 0 (inclusive) and range (exclusive).
@@ -45,8 +46,57 @@ extern int sfx_random(int range);
 // Apply squareDuty to sawtooth waveform.
 #define SAWTOOTH_DUTY
 
+// Define SFX_FIXED_POINT to run the oscillators, filters, envelope & phaser
+// with integer math.  Only the per-sample pitch, duty & filter sweeps remain
+// in floating point (see README.md for the deviation from the reference).
+// As it selects the SfxSample type in sfx_gen.h it must be passed to the
+// compiler (-DSFX_FIXED_POINT) rather than defined here.
+
 #define PI  3.14159265f
 
+// Return wall clock time in seconds.
+static double timeSeconds()
+{
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Define SFX_PROFILE to collect the SfxSynth profile counters.
+#ifdef SFX_PROFILE
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define profileTicks()  __rdtsc()
+#elif defined(_MSC_VER)
+#include <intrin.h>
+#define profileTicks()  __rdtsc()
+#else
+static uint64_t profileTicks()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+#endif
+#define PROF_BEGIN      uint64_t profT = profileTicks()
+#define PROF_STAGE(S)   { uint64_t t = profileTicks(); \
+                          prof->ticks[S] += t - profT; profT = t; }
+#define PROF_COUNT(F)   ++prof->F
+
+const char* sfx_profileStageName(int stage)
+{
+    static const char* names[SFX_PROF_COUNT] = {
+        "setup", "pitch", "vibrato", "envelope", "oscillator", "noise",
+        "filter", "phaser", "output"
+    };
+    return (stage >= 0 && stage < SFX_PROF_COUNT) ? names[stage] : "";
+}
+#else
+#define PROF_BEGIN
+#define PROF_STAGE(S)
+#define PROF_COUNT(F)
+#endif
+
 /*
  * Allocate a synth structure and sample buffer as a single block of memory.
  * Returns a pointer to an initialized SfxSynth structure which the caller
@@ -70,6 +120,10 @@ SfxSynth* sfx_allocSynth(int format, int sampleRate, int maxDuration)
         syn->sampleFormat = format;
         syn->sampleRate   = sampleRate;
         syn->maxDuration  = maxDuration;
+        syn->silenceLevel = 0.0f;
+        syn->silenceWindow = 0;
+        syn->controlRate  = 0;
+        syn->fastNoise    = 0;
         syn->samples.f    = (float*) (syn + 1);
     }
     return syn;
@@ -87,12 +141,100 @@ static float rndNP1()
     return (float)sfx_random(20001)/10000.0f - 1.0f;
 }
 
+#ifdef SFX_FIXED_POINT
+#define FIX_ONE     (1 << 24)
+#define SINE_BITS   8
+
+// Multiply a Q24 sample by a Q31 coefficient (rounded to nearest).
+#define MULQ31(a, b)    (int32_t) (((int64_t) (a) * (b) + (1 << 30)) >> 31)
+
+// Q24 sine of one cycle, with an extra entry (the next cycle) for the
+// interpolation.
+static const int32_t sineTable[(1 << SINE_BITS) + 1] = {
+    0, 411734, 823219, 1234209, 1644455, 2053710,
+    2461729, 2868265, 3273073, 3675909, 4076531, 4474698,
+    4870169, 5262706, 5652074, 6038037, 6420363, 6798821,
+    7173184, 7543227, 7908725, 8269460, 8625213, 8975771,
+    9320922, 9660459, 9994176, 10321874, 10643353, 10958422,
+    11266890, 11568571, 11863283, 12150850, 12431097, 12703857,
+    12968964, 13226259, 13475587, 13716797, 13949746, 14174291,
+    14390298, 14597638, 14796184, 14985817, 15166424, 15337895,
+    15500127, 15653022, 15796488, 15930440, 16054795, 16169479,
+    16274424, 16369566, 16454847, 16530216, 16595628, 16651044,
+    16696429, 16731757, 16757007, 16772163, 16777216, 16772163,
+    16757007, 16731757, 16696429, 16651043, 16595628, 16530216,
+    16454846, 16369565, 16274424, 16169479, 16054794, 15930439,
+    15796488, 15653021, 15500126, 15337894, 15166423, 14985817,
+    14796183, 14597637, 14390298, 14174290, 13949745, 13716796,
+    13475586, 13226258, 12968963, 12703856, 12431096, 12150849,
+    11863282, 11568570, 11266889, 10958421, 10643352, 10321872,
+    9994175, 9660457, 9320921, 8975770, 8625212, 8269458,
+    7908724, 7543225, 7173183, 6798820, 6420361, 6038036,
+    5652073, 5262705, 4870167, 4474696, 4076530, 3675908,
+    3273071, 2868263, 2461727, 2053709, 1644453, 1234207,
+    823218, 411732, -1, -411735, -823220, -1234210,
+    -1644456, -2053712, -2461730, -2868266, -3273074, -3675910,
+    -4076532, -4474699, -4870170, -5262708, -5652075, -6038038,
+    -6420364, -6798823, -7173186, -7543228, -7908726, -8269461,
+    -8625214, -8975772, -9320923, -9660460, -9994177, -10321875,
+    -10643355, -10958423, -11266891, -11568572, -11863284, -12150851,
+    -12431098, -12703858, -12968965, -13226259, -13475587, -13716798,
+    -13949746, -14174292, -14390299, -14597638, -14796184, -14985818,
+    -15166424, -15337895, -15500127, -15653022, -15796489, -15930440,
+    -16054795, -16169480, -16274424, -16369566, -16454847, -16530216,
+    -16595628, -16651044, -16696429, -16731758, -16757007, -16772163,
+    -16777216, -16772163, -16757007, -16731757, -16696429, -16651043,
+    -16595628, -16530215, -16454846, -16369565, -16274423, -16169479,
+    -16054794, -15930439, -15796487, -15653021, -15500126, -15337894,
+    -15166423, -14985816, -14796182, -14597636, -14390297, -14174289,
+    -13949744, -13716796, -13475585, -13226257, -12968962, -12703855,
+    -12431095, -12150848, -11863281, -11568569, -11266888, -10958420,
+    -10643351, -10321871, -9994174, -9660456, -9320920, -8975768,
+    -8625210, -8269457, -7908722, -7543224, -7173182, -6798819,
+    -6420360, -6038034, -5652071, -5262704, -4870166, -4474695,
+    -4076528, -3675906, -3273070, -2868262, -2461726, -2053707,
+    -1644452, -1234206, -823216, -411731, 3
+};
+
+// Return the Q24 sine of phase (0 to 0xffffffff is one cycle).
+static int32_t sineFixed(uint32_t phase)
+{
+    const int32_t* t = sineTable + (phase >> (32 - SINE_BITS));
+    int32_t frac = (phase >> (20 - SINE_BITS)) & 0xfff;
+    return t[0] + (((t[1] - t[0]) * frac) >> 12);
+}
+
+// Return Q24 0.0 to 1.0 (both inclusive) with the frnd() sequence.
+static int32_t frndFixed()
+{
+    return (int32_t) ((int64_t) sfx_random(10001) * FIX_ONE / 10000);
+}
+
+// Return Q24 -1.0 to 1.0 (both inclusive) with the rndNP1() sequence.
+static int32_t rndNP1Fixed()
+{
+    return (int32_t) ((int64_t) (sfx_random(20001) - 10000) * FIX_ONE / 10000);
+}
+
+#define NOISE_VALUE()   rndNP1Fixed()
+#define PINK_WHITE()    frndFixed()
+#define NOISE_U32(h)    ((int32_t) (h) >> 7)
+#define PINK_U32(h)     (int32_t) ((h) >> 8)
+#define PINK_OUT(sum)   (sum * 2 / PINK_SIZE - FIX_ONE)
+#else
+#define NOISE_VALUE()   rndNP1()
+#define PINK_WHITE()    frnd(1.0f)
+#define NOISE_U32(h)    ((float) (int32_t) (h) * (1.0f / 2147483648.0f))
+#define PINK_U32(h)     ((float) ((h) >> 8) * (1.0f / 16777216.0f))
+#define PINK_OUT(sum)   ((sum/PINK_SIZE) * 2.0f - 1.0f)
+#endif
+
 #define PINK_SIZE   5
 
 // Return -1.0 to 1.0.
-static float pinkValue(int* pinkI, float* whiteValue)
+static SfxSample pinkValue(int* pinkI, SfxSample* whiteValue)
 {
-    float sum = 0.0;
+    SfxSample sum = 0;
     int bitsChanged;
     int lastI = *pinkI;
     int i = lastI + 1;
@@ -103,23 +245,117 @@ static float pinkValue(int* pinkI, float* whiteValue)
 
     for (i = 0; i < PINK_SIZE; ++i) {
         if (bitsChanged & (1 << i))
-            whiteValue[i] = frnd(1.0f);
+            whiteValue[i] = PINK_WHITE();
         sum += whiteValue[i];
     }
-    return (sum/PINK_SIZE) * 2.0f - 1.0f;
+    return PINK_OUT(sum);
 }
 
 /*
- * Synthesize wave data from parameters.
- * A 44100Hz, mono channel wave is generated.
+ * The fast noise generator used when synth->fastNoise is set.  Each value is
+ * a hash of its position in the sequence (the lowbias32 hash by Chris
+ * Wellons), so the buffer fill has no dependency between values and can be
+ * vectorized by the compiler.
+ */
+static uint32_t noiseHash(uint32_t x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352d;
+    x ^= x >> 15;
+    x *= 0x846ca68b;
+    x ^= x >> 16;
+    return x;
+}
+
+#if defined(__GNUC__)
+#define ctz32(x)    __builtin_ctz(x)
+#else
+static int ctz32(uint32_t x)
+{
+    int n = 0;
+    while (! (x & 1)) {
+        x >>= 1;
+        ++n;
+    }
+    return n;
+}
+#endif
+
+// Fill buf with 32 white noise values of -1.0 to 1.0.
+static void fastNoiseFill(SfxSample* buf, uint32_t* count)
+{
+    uint32_t start = *count;
+    int i;
+    for (i = 0; i < 32; ++i)
+        buf[i] = NOISE_U32(noiseHash(start + i));
+    *count = start + 32;
+}
+
+/*
+ * Fill buf with 32 pink noise values of -1.0 to 1.0.  This is the
+ * Voss-McCartney method where only the row selected by the trailing zeros of
+ * the counter changes for each value (row 0 every second value, up to
+ * row 4 every sixteenth).
+ */
+static void fastPinkFill(SfxSample* buf, SfxSample* row, int* pinkI,
+                         uint32_t* count)
+{
+    SfxSample sum;
+    int i, n = *pinkI;
+    for (i = 0; i < 32; ++i) {
+        n = (n + 1) & 0x1f;
+        row[ctz32(n | 0x10)] = PINK_U32(noiseHash((*count)++));
+        sum = row[0] + row[1] + row[2] + row[3] + row[4];
+        buf[i] = PINK_OUT(sum);
+    }
+    *pinkI = n;
+}
+
+/*
+ * Begin synthesis of a sound.  The samples are then produced by calling
+ * sfx_generateBlock() until it returns less than the requested count.
  *
- * Return the number of samples generated.
+ * The parameters are copied so the caller may change or free them while
+ * the sound is being generated.
  */
-int sfx_generateWave(SfxSynth* synth, const SfxParams* sp)
+void sfx_startWave(SfxSynth* synth, const SfxParams* sp)
 {
-    float* phaserBuffer = synth->phaserBuffer;
-    float* noiseBuffer  = synth->noiseBuffer;
-    int phase = 0;
+    SfxGenState* st = &synth->state;
+
+    st->params = *sp;
+    st->sampleCount = -1;       // Reset on first sfx_generateBlock.
+    st->endReason = SFX_END_NONE;
+    st->clipped = 0;
+    st->lastLoud = -1;
+    st->collectStats = 0;
+    st->peak = 0.0f;
+    st->sum = st->sumSquares = st->seconds = 0.0;
+    if (synth->fastNoise)
+        st->noiseCount = noiseHash(sp->randSeed ? sp->randSeed :
+                                   (uint32_t) sfx_random(0x7fffffff));
+#ifdef SFX_PROFILE
+    memset(&synth->profile, 0, sizeof(SfxProfile));
+#endif
+}
+
+/*
+ * Synthesize the next part of the sound begun with sfx_startWave().
+ * Up to sampleLimit samples in synth->sampleFormat are written to output.
+ * A 44100Hz, mono channel wave is generated and the total length is limited
+ * to synth->maxDuration seconds.
+ *
+ * Return the number of samples generated.  This will be less than
+ * sampleLimit when the end of the sound is reached.  When ended by
+ * synth->silenceWindow the quiet samples are included, and the trimCount
+ * of sfx_getStats() gives the length without them.
+ */
+int sfx_generateBlock(SfxSynth* synth, void* output, int sampleLimit)
+{
+    SfxGenState* st = &synth->state;
+    const SfxParams* sp = &st->params;
+    SfxSample* phaserBuffer = synth->phaserBuffer;
+    SfxSample* noiseBuffer  = synth->noiseBuffer;
+    int phase;
     double fperiod;
     double fmaxperiod;
     double fslide;
@@ -129,18 +365,18 @@ int sfx_generateWave(SfxSynth* synth, const SfxParams* sp)
     float squareSlide;
     int envStage;
     int envTime;
-    int envLength[3];
-    float envVolume;
+    int* envLength = st->envLength;
+    SfxSample envVolume;
     float fphase;
     float fdphase;
     int iphase;
     int ipp;
-    float fltp;
-    float fltdp;
+    SfxSample fltp;
+    SfxSample fltdp;
     float fltw;
     float fltwd;
     float fltdmp;
-    float fltphp;
+    SfxSample fltphp;
     float flthp;
     float flthpd;
     float vibratoPhase;
@@ -153,18 +389,31 @@ int sfx_generateWave(SfxSynth* synth, const SfxParams* sp)
     double arpeggioModulation;
     float minFreq, sslide;
     int pinkI;
-    int i, sampleCount;
-
-
-    // Sanity check some related parameters.
-    minFreq = sp->minFrequency;
-    if (minFreq > sp->startFrequency)
-        minFreq = sp->startFrequency;
-
-    sslide = sp->slide;
-    if (sslide < sp->deltaSlide)
-        sslide = sp->deltaSlide;
-
+    int i, sampleCount, sampleEnd, firstSample;
+    int collect = st->collectStats;
+    int silenceWindow = synth->silenceWindow;
+    int controlRate = synth->controlRate;
+    int fastNoise = synth->fastNoise;
+    int ctlLeft;
+    int segLeft;
+    int dutySweep, hpSweep;     // Set when the value may change this sample.
+#ifdef SFX_FIXED_POINT
+    int32_t envA, envB, envC, envD, envX, envStep;
+    float heldDuty, heldLpw, heldHpw;
+#else
+    float envA, envB, envC, envD, envX, envStep;
+#endif
+    float ctlPeriod, ctlPeriodStep, ctlDutyStep, ctlHpStep, ctlLpStep;
+    int lastLoud = st->lastLoud;
+    int clipped = st->clipped;
+    float peak = st->peak;
+    double statSum = st->sum;
+    double statSumSq = st->sumSquares;
+    double startTime = 0.0;
+#ifdef SFX_PROFILE
+    SfxProfile* prof = &synth->profile;
+#endif
+    PROF_BEGIN;
 
 #define RESET_SAMPLE \
     fperiod = 100.0/(sp->startFrequency*sp->startFrequency + 0.001); \
@@ -181,148 +430,471 @@ int sfx_generateWave(SfxSynth* synth, const SfxParams* sp)
     arpeggioLimit = (sp->changeSpeed == 1.0f) ? 0 : \
                         (int)(powf(1.0f - sp->changeSpeed, 2.0f)*20000 + 32);
 
-
-    RESET_SAMPLE
-
-    // Reset filter
-    fltp = fltdp = 0.0f;
-    fltw = powf(sp->lpfCutoff, 3.0f)*0.1f;
-    fltwd = 1.0f + sp->lpfCutoffSweep*0.0001f;
-    fltdmp = 5.0f/(1.0f + powf(sp->lpfResonance, 2.0f)*20.0f)*(0.01f + fltw);
-    if (fltdmp > 0.8f)
-        fltdmp = 0.8f;
-    fltphp = 0.0f;
-    flthp = powf(sp->hpfCutoff, 2.0f)*0.1f;
-    flthpd = 1.0f + sp->hpfCutoffSweep*0.0003f;
-
-    // Reset vibrato
-    vibratoPhase = 0.0f;
-    vibratoSpeed = powf(sp->vibratoSpeed, 2.0f)*0.01f;
-    vibratoAmplitude = sp->vibratoDepth*0.5f;
-
-    // Reset envelope
-    envVolume = 0.0f;
-    envStage = envTime = 0;
-    envLength[0] = (int)(sp->attackTime *sp->attackTime *100000.0f);
-    envLength[1] = (int)(sp->sustainTime*sp->sustainTime*100000.0f);
-    envLength[2] = (int)(sp->decayTime  *sp->decayTime  *100000.0f);
-
-    fphase = powf(sp->phaserOffset, 2.0f)*1020.0f;
-    if (sp->phaserOffset < 0.0f)
-        fphase = -fphase;
-
-    fdphase = powf(sp->phaserSweep, 2.0f)*1.0f;
-    if (sp->phaserSweep < 0.0f)
-        fdphase = -fdphase;
-
-    iphase = abs((int)fphase);
-    ipp = 0;
-    for (i = 0; i < 1024; i++)
-        phaserBuffer[i] = 0.0f;
-
-    if (sp->waveType == SFX_PINK_NOISE) {
-        pinkI = 0;
-        for (i = 0; i < PINK_SIZE; i++)
-            synth->pinkWhiteValue[i] = frnd(1.0f);
+/*
+ * Each envelope stage is a ramp of x (0.0 to 1.0 over the stage length):
+ *   attack:  x
+ *   sustain: 1 + (1 - x) * 2 * sustainPunch
+ *   decay:   1 - x
+ * These are written as envA + (envB + envC * x) * envD.  In the default
+ * mode x is envTime divided by the stage length, as in the reference, so the
+ * results are identical.  With controlRate (or SFX_FIXED_POINT) x is made
+ * from the reciprocal envStep, which can differ in the last bits.
+ */
+#ifdef SFX_FIXED_POINT
+// Here x is Q30, envA & envD are Q16, envB is Q30 and envC is 1 or -1.
+#define SET_ENVELOPE \
+    envStep = ((1 << 30) + envLength[envStage] / 2) / envLength[envStage]; \
+    envA = envB = 0; \
+    envC = 1; \
+    envD = 1 << 16; \
+    if (envStage == 1) { \
+        envA = 1 << 16; \
+        envB = 1 << 30; \
+        envC = -1; \
+        envD = (int32_t) (2.0f * sp->sustainPunch * 65536.0f); \
+    } else if (envStage == 2) { \
+        envA = 1 << 16; \
+        envC = -1; \
+    }
+#else
+#define SET_ENVELOPE \
+    envStep = 1.0f / envLength[envStage]; \
+    envA = envB = 0.0f; \
+    envC = envD = 1.0f; \
+    if (envStage == 1) { \
+        envA = envB = 1.0f; \
+        envC = -1.0f; \
+        envD = 2.0f * sp->sustainPunch; \
+    } else if (envStage == 2) { \
+        envA = 1.0f; \
+        envC = -1.0f; \
     }
+#endif
 
 #define RESET_NOISE \
     if (sp->waveType == SFX_NOISE) { \
-        for (i = 0; i < 32; i++) \
-            noiseBuffer[i] = rndNP1(); \
+        if (fastNoise) \
+            fastNoiseFill(noiseBuffer, &st->noiseCount); \
+        else { \
+            for (i = 0; i < 32; i++) \
+                noiseBuffer[i] = NOISE_VALUE(); \
+        } \
+        PROF_COUNT(noiseRefills); \
     } else if (sp->waveType == SFX_PINK_NOISE) { \
-        for (i = 0; i < 32; i++) \
-            noiseBuffer[i] = pinkValue(&pinkI, synth->pinkWhiteValue); \
+        if (fastNoise) \
+            fastPinkFill(noiseBuffer, synth->pinkWhiteValue, &pinkI, \
+                         &st->noiseCount); \
+        else { \
+            for (i = 0; i < 32; i++) \
+                noiseBuffer[i] = pinkValue(&pinkI, synth->pinkWhiteValue); \
+        } \
+        PROF_COUNT(noiseRefills); \
     }
 
-    RESET_NOISE
+    if (collect)
+        startTime = timeSeconds();
+
+    if (st->sampleCount < 0) {
+        // Sanity check some related parameters.
+        minFreq = sp->minFrequency;
+        if (minFreq > sp->startFrequency)
+            minFreq = sp->startFrequency;
+
+        sslide = sp->slide;
+        if (sslide < sp->deltaSlide)
+            sslide = sp->deltaSlide;
+
+
+        RESET_SAMPLE
+        phase = 0;
+
+        // Reset filter
+        fltp = fltdp = 0.0f;
+        fltw = powf(sp->lpfCutoff, 3.0f)*0.1f;
+        fltwd = 1.0f + sp->lpfCutoffSweep*0.0001f;
+        fltdmp = 5.0f/(1.0f + powf(sp->lpfResonance, 2.0f)*20.0f)*
+                 (0.01f + fltw);
+        if (fltdmp > 0.8f)
+            fltdmp = 0.8f;
+        fltphp = 0.0f;
+        flthp = powf(sp->hpfCutoff, 2.0f)*0.1f;
+        flthpd = 1.0f + sp->hpfCutoffSweep*0.0003f;
+
+        // Reset vibrato
+        vibratoPhase = 0.0f;
+        vibratoSpeed = powf(sp->vibratoSpeed, 2.0f)*0.01f;
+        vibratoAmplitude = sp->vibratoDepth*0.5f;
+
+        // Reset envelope
+        envVolume = 0.0f;
+        envStage = envTime = 0;
+        envLength[0] = (int)(sp->attackTime *sp->attackTime *100000.0f);
+        envLength[1] = (int)(sp->sustainTime*sp->sustainTime*100000.0f);
+        envLength[2] = (int)(sp->decayTime  *sp->decayTime  *100000.0f);
+
+        fphase = powf(sp->phaserOffset, 2.0f)*1020.0f;
+        if (sp->phaserOffset < 0.0f)
+            fphase = -fphase;
+
+        fdphase = powf(sp->phaserSweep, 2.0f)*1.0f;
+        if (sp->phaserSweep < 0.0f)
+            fdphase = -fdphase;
+
+        iphase = abs((int)fphase);
+        ipp = 0;
+        for (i = 0; i < 1024; i++)
+            phaserBuffer[i] = 0.0f;
+
+        pinkI = 0;
+        if (sp->waveType == SFX_PINK_NOISE) {
+            for (i = 0; i < PINK_SIZE; i++)
+                synth->pinkWhiteValue[i] = fastNoise ?
+                    PINK_U32(noiseHash(st->noiseCount++)) : PINK_WHITE();
+        }
 
-    repeatTime = 0;
-    repeatLimit = (int)(powf(1.0f - sp->repeatSpeed, 2.0f)*20000 + 32);
-    if (sp->repeatSpeed == 0.0f)
-        repeatLimit = 0;
+        RESET_NOISE
+
+        ctlLeft = 0;
+        ctlPeriod = ctlPeriodStep = ctlDutyStep = ctlHpStep = ctlLpStep = 0.0f;
+#ifdef SFX_FIXED_POINT
+        heldDuty = squareDuty;
+        heldLpw  = fltw;
+        heldHpw  = flthp;
+#endif
+
+        repeatTime = 0;
+        repeatLimit = (int)(powf(1.0f - sp->repeatSpeed, 2.0f)*20000 + 32);
+        if (sp->repeatSpeed == 0.0f)
+            repeatLimit = 0;
+
+        sampleCount = 0;
+        sampleEnd = synth->sampleRate * synth->maxDuration;
+        PROF_STAGE(SFX_PROF_SETUP)
+    } else {
+        // Restore state saved by the previous call.
+        fperiod          = st->fperiod;
+        fmaxperiod       = st->fmaxperiod;
+        fslide           = st->fslide;
+        fdslide          = st->fdslide;
+        arpeggioModulation = st->arpeggioModulation;
+        squareDuty       = st->squareDuty;
+        squareSlide      = st->squareSlide;
+        envVolume        = st->envVolume;
+        fphase           = st->fphase;
+        fdphase          = st->fdphase;
+        fltp             = st->fltp;
+        fltdp            = st->fltdp;
+        fltw             = st->fltw;
+        fltwd            = st->fltwd;
+        fltdmp           = st->fltdmp;
+        fltphp           = st->fltphp;
+        flthp            = st->flthp;
+        flthpd           = st->flthpd;
+        vibratoPhase     = st->vibratoPhase;
+        vibratoSpeed     = st->vibratoSpeed;
+        vibratoAmplitude = st->vibratoAmplitude;
+        minFreq          = st->minFreq;
+        sslide           = st->sslide;
+        phase            = st->phase;
+        period           = st->period;
+        envStage         = st->envStage;
+        envTime          = st->envTime;
+        iphase           = st->iphase;
+        ipp              = st->ipp;
+        repeatTime       = st->repeatTime;
+        repeatLimit      = st->repeatLimit;
+        arpeggioTime     = st->arpeggioTime;
+        arpeggioLimit    = st->arpeggioLimit;
+        pinkI            = st->pinkI;
+        ctlLeft          = st->ctlLeft;
+        ctlPeriod        = st->ctlPeriod;
+        ctlPeriodStep    = st->ctlPeriodStep;
+        ctlDutyStep      = st->ctlDutyStep;
+        ctlHpStep        = st->ctlHpStep;
+        ctlLpStep        = st->ctlLpStep;
+#ifdef SFX_FIXED_POINT
+        heldDuty         = st->heldDuty;
+        heldLpw          = st->heldLpw;
+        heldHpw          = st->heldHpw;
+#endif
+        sampleCount      = st->sampleCount;
+        sampleEnd        = st->sampleEnd;
+    }
 
 
     // Synthesize samples.
     {
-    const float sampleCoefficient = 0.2f;   // Scales sample value to [-1..1]
-#if SINGLE_FORMAT == 1
-    uint8_t* buffer = synth->samples.u8;
-#elif SINGLE_FORMAT == 2
-    int16_t* buffer = synth->samples.i16;
+#ifdef SFX_FIXED_POINT
+    const int64_t sampleCoefficient = 209715;   // 0.2 in Q20
+    const int64_t silenceLevel = (int64_t) (synth->silenceLevel * FIX_ONE);
+    const int32_t fltdmpQ = (int32_t) (fltdmp * 2147483648.0f);
+    const float fltwd8 = powf(fltwd, 8.0f);  // Low-pass sweep per sample
+    const int lpfOn = (sp->lpfCutoff != 1.0f);
+    const int lpSweeping = (fltwd8 != 1.0f);
+    int64_t ssample, sawUp = 0;
+    int32_t pp, fltwQ, flthpQ, sawDown = 0;
+    uint32_t fp, duty, recip = 0;
+    int recipShift = 0, recipPeriod = 0;
+    int lpSweep;
+    float rfperiod;
+
+    // The duty & filter coefficients are converted for the integer engine
+    // only when they change.
+#ifdef SAWTOOTH_DUTY
+#define FIX_DUTY(d) \
+    duty = (d > 0.0f) ? (uint32_t) (d * 4294967296.0f) : 0; \
+    if (sp->waveType == SFX_SAWTOOTH) { \
+        sawUp = duty ? (int64_t) (2.0f * FIX_ONE / d) : 0; \
+        sawDown = (int32_t) (2.0f * FIX_ONE / (1.0f - d)); \
+    }
 #else
-    float* buffer = synth->samples.f;
+#define FIX_DUTY(d) \
+    duty = (d > 0.0f) ? (uint32_t) (d * 4294967296.0f) : 0;
 #endif
+#define FIX_LPW(w)  fltwQ  = (int32_t) (w * 2147483648.0f);
+#define FIX_HPW(w)  flthpQ = (int32_t) (w * 2147483648.0f);
+#else
+    const float sampleCoefficient = 0.2f;   // Scales sample value to [-1..1]
     float ssample, rfperiod, fp, pp;
-    int sampleEnd = synth->sampleRate * synth->maxDuration;
+#endif
+    union {
+        uint8_t* u8;
+        int16_t* i16;
+        float*   f;
+    } buffer;
+    const int dutySweeping = (squareSlide != 0.0f);
+    const int hpSweeping = (flthpd != 1.0f);
+    int blockEnd;
     int si;
 
-    for (sampleCount = 0; sampleCount < sampleEnd; sampleCount++)
+    buffer.f = (float*) output;
+    firstSample = sampleCount;
+    blockEnd = sampleCount + sampleLimit;
+    if (blockEnd > sampleEnd)
+        blockEnd = sampleEnd;
+
+    // Check for events on the first sample, which sets the envelope ramp.
+    segLeft = 1;
+    envA = envB = envC = envD = envX = envStep = 0.0f;
+
+    // The first sample of a sound clamps the duty & filters, after which
+    // they are only updated if swept.
+    dutySweep = (firstSample == 0) || dutySweeping;
+    hpSweep = (firstSample == 0) || hpSweeping;
+#ifdef SFX_FIXED_POINT
+    lpSweep = (firstSample == 0) || lpSweeping;
+    if (controlRate) {
+        FIX_DUTY(heldDuty)
+        FIX_LPW(heldLpw)
+        FIX_HPW(heldHpw)
+    } else {
+        FIX_DUTY(squareDuty)
+        FIX_LPW(fltw)
+        FIX_HPW(flthp)
+    }
+#endif
+
+    for (; sampleCount < blockEnd; sampleCount++)
     {
         repeatTime++;
-        if (repeatLimit != 0 && repeatTime >= repeatLimit) {
-            repeatTime = 0;
-            RESET_SAMPLE
-        }
-
-        // Frequency envelopes/arpeggios
         arpeggioTime++;
+        envTime++;
 
-        if ((arpeggioLimit != 0) && (arpeggioTime >= arpeggioLimit)) {
-            arpeggioLimit = 0;
-            fperiod *= arpeggioModulation;
-        }
+        // The repeat, arpeggio & volume envelope events are only checked
+        // at the end of each segment between them.
+        if (--segLeft == 0) {
+            if (repeatLimit != 0 && repeatTime >= repeatLimit) {
+                repeatTime = 0;
+                RESET_SAMPLE
+                dutySweep = 1;      // Clamp the reset duty.
+                arpeggioTime = 1;   // Include this sample.
+                PROF_COUNT(repeatResets);
+            }
 
-        fslide += fdslide;
-        fperiod *= fslide;
+            // Frequency envelopes/arpeggios
+            if ((arpeggioLimit != 0) && (arpeggioTime >= arpeggioLimit)) {
+                arpeggioLimit = 0;
+                fperiod *= arpeggioModulation;
+            }
 
-        if (fperiod > fmaxperiod) {
-            fperiod = fmaxperiod;
-            if (minFreq > 0.0f)
-                sampleEnd = sampleCount;    // End generator loop.
+            // Volume envelope
+            if (envTime > envLength[envStage]) {
+                envTime = 0;
+next_stage:
+                envStage++;
+                PROF_COUNT(envTransitions);
+                if (envStage == 3) {
+                    sampleEnd = sampleCount;
+                    st->endReason = SFX_END_ENVELOPE;
+                    break;          // End generator loop.
+                }
+                if (envLength[envStage] == 0)
+                    goto next_stage;
+            }
+            SET_ENVELOPE
+            envX = (envTime - 1) * envStep;
+
+            segLeft = envLength[envStage] - envTime + 1;
+            if (repeatLimit != 0 && repeatLimit - repeatTime < segLeft)
+                segLeft = repeatLimit - repeatTime;
+            if (arpeggioLimit != 0 && arpeggioLimit - arpeggioTime < segLeft)
+                segLeft = arpeggioLimit - arpeggioTime;
         }
 
-        rfperiod = (float)fperiod;
+        if (controlRate) {
+            if (ctlLeft == 0) {
+                // Advance the slides & sweeps to the end of a control
+                // period which stops short of any repeat or arpeggio.
+                double slideAvg, periodEnd;
+                float end, rfEnd;
+                int n = controlRate;
+
+                if (repeatLimit != 0 && repeatLimit - repeatTime < n)
+                    n = repeatLimit - repeatTime;
+                if (arpeggioLimit != 0 && arpeggioLimit - arpeggioTime < n)
+                    n = arpeggioLimit - arpeggioTime;
+
+                ctlPeriod = (float) fperiod;
+                if (vibratoAmplitude > 0.0f)
+                    ctlPeriod = (float) (fperiod *
+                            (1.0 + sinf(vibratoPhase) * vibratoAmplitude));
+
+                slideAvg = fslide + fdslide * 0.5 * (n + 1);
+                periodEnd = fperiod * pow(slideAvg, n);
+                if (periodEnd > fmaxperiod) {
+                    if (minFreq > 0.0f) {
+                        // Find the sample which crosses the limit.
+                        int k = 1;
+                        if (slideAvg > 1.0 && fperiod < fmaxperiod)
+                            k = (int) ceil(log(fmaxperiod / fperiod) /
+                                           log(slideAvg));
+                        if (k < 1)
+                            k = 1;
+                        else if (k > n)
+                            k = n;
+                        n = k;
+                        sampleEnd = sampleCount + k;
+                        if (blockEnd > sampleEnd)
+                            blockEnd = sampleEnd;
+                        st->endReason = SFX_END_MIN_FREQ;
+                    }
+                    periodEnd = fmaxperiod;
+                }
+                fslide += fdslide * n;
+                fperiod = periodEnd;
+
+                rfEnd = (float) fperiod;
+                if (vibratoAmplitude > 0.0f) {
+                    vibratoPhase += vibratoSpeed * n;
+                    rfEnd = (float) (fperiod *
+                            (1.0 + sinf(vibratoPhase) * vibratoAmplitude));
+                }
+                ctlPeriodStep = powf(rfEnd / ctlPeriod, 1.0f / n);
+
+                if (squareDuty > 0.5f)
+                    squareDuty = 0.5f;
+                end = squareDuty + squareSlide * n;
+                if (end < 0.0f)
+                    end = 0.0f;
+                else if (end > 0.5f)
+                    end = 0.5f;
+                ctlDutyStep = (end - squareDuty) / n;
+
+                end = flthp * powf(flthpd, (float) n);
+                if (end < 0.00001f)
+                    end = 0.00001f;
+                else if (end > 0.1f)
+                    end = 0.1f;
+                ctlHpStep = (end - flthp) / n;
+
+                end = fltw * powf(fltwd, 8.0f * n);
+                if (end < 0.0f)
+                    end = 0.0f;
+                else if (end > 0.1f)
+                    end = 0.1f;
+                ctlLpStep = (end - fltw) / n;
+
+#ifdef SFX_FIXED_POINT
+                // The integer engine holds the duty & filters at their
+                // middle values for the period rather than stepping them.
+                heldDuty = squareDuty + ctlDutyStep * (n * 0.5f);
+                heldHpw  = flthp + ctlHpStep * (n * 0.5f);
+                heldLpw  = fltw + ctlLpStep * (n * 0.5f);
+                FIX_DUTY(heldDuty)
+                FIX_HPW(heldHpw)
+                FIX_LPW(heldLpw)
+                squareDuty += ctlDutyStep * n;
+                flthp      += ctlHpStep * n;
+                fltw       += ctlLpStep * n;
+#endif
+                ctlLeft = n;
+            }
+            --ctlLeft;
+            ctlPeriod  *= ctlPeriodStep;
+#ifndef SFX_FIXED_POINT
+            squareDuty += ctlDutyStep;
+            flthp      += ctlHpStep;
+            fltw       += ctlLpStep;
+#endif
+            rfperiod = ctlPeriod;
+        } else {
+            fslide += fdslide;
+            fperiod *= fslide;
+
+            if (fperiod > fmaxperiod) {
+                fperiod = fmaxperiod;
+                if (minFreq > 0.0f) {
+                    // End after this sample.
+                    sampleEnd = blockEnd = sampleCount + 1;
+                    st->endReason = SFX_END_MIN_FREQ;
+                }
+            }
+
+            rfperiod = (float)fperiod;
 
-        if (vibratoAmplitude > 0.0f) {
-            vibratoPhase += vibratoSpeed;
-            rfperiod = (float)
-                (fperiod * (1.0 + sinf(vibratoPhase) * vibratoAmplitude));
+            if (vibratoAmplitude > 0.0f) {
+                PROF_STAGE(SFX_PROF_PITCH)
+                vibratoPhase += vibratoSpeed;
+                rfperiod = (float)
+                    (fperiod * (1.0 + sinf(vibratoPhase) * vibratoAmplitude));
+                PROF_STAGE(SFX_PROF_VIBRATO)
+            }
+
+            if (dutySweep) {
+                squareDuty += squareSlide;
+                if (squareDuty < 0.0f)
+                    squareDuty = 0.0f;
+                else if (squareDuty > 0.5f)
+                    squareDuty = 0.5f;
+                dutySweep = dutySweeping;
+#ifdef SFX_FIXED_POINT
+                FIX_DUTY(squareDuty)
+#endif
+            }
         }
 
         period = (int)rfperiod;
         if (period < 8)
             period = 8;
+        PROF_STAGE(SFX_PROF_PITCH)
 
-        squareDuty += squareSlide;
-        if (squareDuty < 0.0f)
-            squareDuty = 0.0f;
-        else if (squareDuty > 0.5f)
-            squareDuty = 0.5f;
-
-        // Volume envelope
-        envTime++;
-        if (envTime > envLength[envStage]) {
-            envTime = 0;
-next_stage:
-            envStage++;
-            if (envStage == 3)
-                break;          // End generator loop.
-            if (envLength[envStage] == 0)
-                goto next_stage;
-        }
-
-        switch (envStage) {
-            case 0:
-                envVolume = (float)envTime/envLength[0];
-                break;
-            case 1:
-                envVolume = 1.0f + powf(1.0f - (float)envTime/envLength[1], 1.0f) * 2.0f * sp->sustainPunch;
-                break;
-            case 2:
-                envVolume = 1.0f - (float)envTime/envLength[2];
-                break;
-        }
+        // Volume envelope ramp
+#ifdef SFX_FIXED_POINT
+        envX += envStep;
+        envVolume = envA + (int32_t) (((int64_t) ((envB + envC * envX) >> 14)
+                                       * envD) >> 16);
+#else
+        // Only the controlRate mode replaces the divide with the reciprocal;
+        // the default mode keeps it so the output matches the reference.
+        // The ramp is computed from envTime so it does not depend on where
+        // sfx_generateBlock() calls begin.
+        if (controlRate)
+            envX = envTime * envStep;
+        else
+            envX = (float)envTime/envLength[envStage];
+        envVolume = envA + (envB + envC * envX) * envD;
+#endif
+        PROF_STAGE(SFX_PROF_ENVELOPE)
 
         // Phaser step
         fphase += fdphase;
@@ -330,15 +902,177 @@ next_stage:
 
         if (iphase > 1023)
             iphase = 1023;
+        PROF_STAGE(SFX_PROF_PHASER)
 
-        if (flthpd != 0.0f) {
+        if (hpSweep && ! controlRate) {
             flthp *= flthpd;
             if (flthp < 0.00001f)
                 flthp = 0.00001f;
             else if (flthp > 0.1f)
                 flthp = 0.1f;
+            hpSweep = hpSweeping;
+#ifdef SFX_FIXED_POINT
+            FIX_HPW(flthp)
+#endif
+        }
+        PROF_STAGE(SFX_PROF_FILTER)
+
+#ifdef SFX_FIXED_POINT
+        if (lpSweep && ! controlRate) {
+            fltw *= fltwd8;
+            if (fltw < 0.0f)
+                fltw = 0.0f;
+            else if (fltw > 0.1f)
+                fltw = 0.1f;
+            lpSweep = lpSweeping;
+            FIX_LPW(fltw)
+        }
+
+        // Oscillator phase is a 0.32 fraction of the period.  The reciprocal
+        // is rounded up so that exact fractions such as a half period compare
+        // like the float division, and is scaled by 2^16 for long periods.
+        if (period != recipPeriod) {
+            recipPeriod = period;
+            if (period > 0x10000) {
+                recipShift = 16;
+                recip = (uint32_t) (((((uint64_t) 1) << 48) - 1) / period + 1);
+            } else {
+                recipShift = 0;
+                recip = 0xffffffff / period + 1;
+            }
+        }
+
+        // 8x supersampling
+        ssample = 0;
+        for (si = 0; si < 8; si++) {
+            int32_t sample = 0;
+            phase++;
+
+            if (phase >= period) {
+                phase %= period;
+
+                PROF_STAGE(SFX_PROF_OSCILLATOR)
+                RESET_NOISE
+                PROF_STAGE(SFX_PROF_NOISE)
+            }
+
+            // Base waveform
+            fp = (uint32_t) (((uint64_t) phase * recip) >> recipShift);
+
+            switch (sp->waveType) {
+                case SFX_SQUARE:
+                    sample = (fp < duty) ? FIX_ONE/2 : -FIX_ONE/2;
+                    break;
+                case SFX_SAWTOOTH:
+#ifdef SAWTOOTH_DUTY
+                    sample = (fp < duty) ?
+                        (int32_t) ((fp * sawUp) >> 32) - FIX_ONE :
+                        FIX_ONE - (int32_t)
+                                  (((int64_t) (fp - duty) * sawDown) >> 32);
+#else
+                    sample = FIX_ONE - (int32_t) (fp >> 7);
+#endif
+                    break;
+                case SFX_SINE:
+                    sample = sineFixed(fp);
+                    break;
+                case SFX_NOISE:
+                case SFX_PINK_NOISE:
+                    sample = noiseBuffer[phase*32/period];
+                    break;
+                case SFX_TRIANGLE:
+                    sample = (fp < 0x80000000) ?
+                                (int32_t) (fp >> 6) - FIX_ONE :
+                                3*FIX_ONE - (int32_t) (fp >> 6);
+                    break;
+            }
+            PROF_STAGE(SFX_PROF_OSCILLATOR)
+
+            // Low-pass filter
+            pp = fltp;
+            if (lpfOn) {
+                fltdp += MULQ31(sample - fltp, fltwQ);
+                fltdp -= MULQ31(fltdp, fltdmpQ);
+            } else {
+                fltp = sample;
+                fltdp = 0;
+            }
+
+            fltp += fltdp;
+
+            // High-pass filter
+            fltphp += fltp - pp;
+            fltphp -= MULQ31(fltphp, flthpQ);
+            sample = fltphp;
+            PROF_STAGE(SFX_PROF_FILTER)
+
+            // Phaser
+            phaserBuffer[ipp & 1023] = sample;
+            sample += phaserBuffer[(ipp - iphase + 1024) & 1023];
+            ipp = (ipp + 1) & 1023;
+
+            ssample += sample;
+            PROF_STAGE(SFX_PROF_PHASER)
+        }
+
+        // Apply the envelope, the average & sampleCoefficient.
+        ssample = (((ssample * envVolume) >> 16) * sampleCoefficient) >> 23;
+
+        if (collect) {
+            float v = (float) ssample * (1.0f / FIX_ONE);
+            float mag = fabsf(v);
+            if (peak < mag)
+                peak = mag;
+            statSum += v;
+            statSumSq += v * v;
+        }
+
+        // Silence is not checked during the attack as it may begin quietly.
+        if (silenceWindow) {
+            if (ssample >= silenceLevel || ssample <= -silenceLevel)
+                lastLoud = sampleCount;
+            else if (envStage > 0 &&
+                     sampleCount - lastLoud >= silenceWindow) {
+                sampleEnd = blockEnd = sampleCount + 1; // End after sample.
+                st->endReason = SFX_END_SILENCE;
+            }
+        }
+
+        // Clamp sample and emit to buffer
+        if (ssample > FIX_ONE) {
+            ssample = FIX_ONE;
+            ++clipped;
+            PROF_COUNT(clamps);
+        } else if (ssample < -FIX_ONE) {
+            ssample = -FIX_ONE;
+            ++clipped;
+            PROF_COUNT(clamps);
         }
 
+        // The integer formats are rounded like the float conversions.
+#define FIX_U8(v)   (uint8_t) ((((int32_t) v * 127) >> 24) + 128)
+#define FIX_I16(v)  (int16_t) ((v * 32767) / FIX_ONE)
+#define FIX_F32(v)  ((float) v * (1.0f / FIX_ONE))
+#if SINGLE_FORMAT == 1
+        *buffer.u8++ = FIX_U8(ssample);
+#elif SINGLE_FORMAT == 2
+        *buffer.i16++ = FIX_I16(ssample);
+#elif SINGLE_FORMAT == 3
+        *buffer.f++ = FIX_F32(ssample);
+#else
+        switch (synth->sampleFormat) {
+            case SFX_U8:
+                *buffer.u8++ = FIX_U8(ssample);
+                break;
+            case SFX_I16:
+                *buffer.i16++ = FIX_I16(ssample);
+                break;
+            case SFX_F32:
+                *buffer.f++ = FIX_F32(ssample);
+                break;
+        }
+#endif
+#else
         // 8x supersampling
         ssample = 0.0f;
         for (si = 0; si < 8; si++) {
@@ -349,7 +1083,9 @@ next_stage:
                 //phase = 0;
                 phase %= period;
 
+                PROF_STAGE(SFX_PROF_OSCILLATOR)
                 RESET_NOISE
+                PROF_STAGE(SFX_PROF_NOISE)
             }
 
             // Base waveform
@@ -382,15 +1118,17 @@ next_stage:
                                           RAMP(fp, 0.5f, 1.0f, 1.0f, -1.0f);
                     break;
             }
+            PROF_STAGE(SFX_PROF_OSCILLATOR)
 
             // Low-pass filter
             pp = fltp;
-            fltw *= fltwd;
-
-            if (fltw < 0.0f)
-                fltw = 0.0f;
-            else if (fltw > 0.1f)
-                fltw = 0.1f;
+            if (! controlRate) {
+                fltw *= fltwd;
+                if (fltw < 0.0f)
+                    fltw = 0.0f;
+                else if (fltw > 0.1f)
+                    fltw = 0.1f;
+            }
 
             if (sp->lpfCutoff != 1.0f) {
                 fltdp += (sample-fltp)*fltw;
@@ -406,6 +1144,7 @@ next_stage:
             fltphp += fltp - pp;
             fltphp -= fltphp*flthp;
             sample = fltphp;
+            PROF_STAGE(SFX_PROF_FILTER)
 
             // Phaser
             phaserBuffer[ipp & 1023] = sample;
@@ -414,41 +1153,192 @@ next_stage:
 
             // Final accumulation and envelope application
             ssample += sample*envVolume;
+            PROF_STAGE(SFX_PROF_PHASER)
         }
 
         ssample = ssample/8 * sampleCoefficient;
 
+        if (collect) {
+            float mag = fabsf(ssample);
+            if (peak < mag)
+                peak = mag;
+            statSum += ssample;
+            statSumSq += ssample * ssample;
+        }
+
+        // Silence is not checked during the attack as it may begin quietly.
+        if (silenceWindow) {
+            if (fabsf(ssample) >= synth->silenceLevel)
+                lastLoud = sampleCount;
+            else if (envStage > 0 &&
+                     sampleCount - lastLoud >= silenceWindow) {
+                sampleEnd = blockEnd = sampleCount + 1; // End after sample.
+                st->endReason = SFX_END_SILENCE;
+            }
+        }
+
         // Clamp sample and emit to buffer
-        if (ssample > 1.0f)
+        if (ssample > 1.0f) {
             ssample = 1.0f;
-        else if (ssample < -1.0f)
+            ++clipped;
+            PROF_COUNT(clamps);
+        } else if (ssample < -1.0f) {
             ssample = -1.0f;
+            ++clipped;
+            PROF_COUNT(clamps);
+        }
 
         //printf("%d %f\n", sampleCount, ssample);
 #if SINGLE_FORMAT == 1
-        *buffer++ = (uint8_t) (ssample*127.0f + 128.0f);
+        *buffer.u8++ = (uint8_t) (ssample*127.0f + 128.0f);
 #elif SINGLE_FORMAT == 2
-        *buffer++ = (int16_t) (ssample*32767.0f);
+        *buffer.i16++ = (int16_t) (ssample*32767.0f);
 #elif SINGLE_FORMAT == 3
-        *buffer++ = ssample;
+        *buffer.f++ = ssample;
 #else
         switch (synth->sampleFormat) {
             case SFX_U8:
-                ((uint8_t*)buffer)[sampleCount] = (uint8_t)
-                                                    (ssample*127.0f + 128.0f);
+                *buffer.u8++ = (uint8_t) (ssample*127.0f + 128.0f);
                 break;
             case SFX_I16:
-                ((int16_t*)buffer)[sampleCount] = (int16_t) (ssample*32767.0f);
+                *buffer.i16++ = (int16_t) (ssample*32767.0f);
                 break;
             case SFX_F32:
-                buffer[sampleCount] = ssample;
+                *buffer.f++ = ssample;
                 break;
         }
 #endif
+#endif  // SFX_FIXED_POINT
+        PROF_STAGE(SFX_PROF_OUTPUT)
     }
     }
 
-    return sampleCount;
+    // Save state for the next call.
+    st->fperiod          = fperiod;
+    st->fmaxperiod       = fmaxperiod;
+    st->fslide           = fslide;
+    st->fdslide          = fdslide;
+    st->arpeggioModulation = arpeggioModulation;
+    st->squareDuty       = squareDuty;
+    st->squareSlide      = squareSlide;
+    st->envVolume        = envVolume;
+    st->fphase           = fphase;
+    st->fdphase          = fdphase;
+    st->fltp             = fltp;
+    st->fltdp            = fltdp;
+    st->fltw             = fltw;
+    st->fltwd            = fltwd;
+    st->fltdmp           = fltdmp;
+    st->fltphp           = fltphp;
+    st->flthp            = flthp;
+    st->flthpd           = flthpd;
+    st->vibratoPhase     = vibratoPhase;
+    st->vibratoSpeed     = vibratoSpeed;
+    st->vibratoAmplitude = vibratoAmplitude;
+    st->minFreq          = minFreq;
+    st->sslide           = sslide;
+    st->phase            = phase;
+    st->period           = period;
+    st->envStage         = envStage;
+    st->envTime          = envTime;
+    st->iphase           = iphase;
+    st->ipp              = ipp;
+    st->repeatTime       = repeatTime;
+    st->repeatLimit      = repeatLimit;
+    st->arpeggioTime     = arpeggioTime;
+    st->arpeggioLimit    = arpeggioLimit;
+    st->pinkI            = pinkI;
+    st->ctlLeft          = ctlLeft;
+    st->ctlPeriod        = ctlPeriod;
+    st->ctlPeriodStep    = ctlPeriodStep;
+    st->ctlDutyStep      = ctlDutyStep;
+    st->ctlHpStep        = ctlHpStep;
+    st->ctlLpStep        = ctlLpStep;
+#ifdef SFX_FIXED_POINT
+    st->heldDuty         = heldDuty;
+    st->heldLpw          = heldLpw;
+    st->heldHpw          = heldHpw;
+#endif
+    st->sampleCount      = sampleCount;
+    st->sampleEnd        = sampleEnd;
+    st->clipped          = clipped;
+    st->lastLoud         = lastLoud;
+    st->peak             = peak;
+    st->sum              = statSum;
+    st->sumSquares       = statSumSq;
+
+    if (sampleCount >= sampleEnd && st->endReason == SFX_END_NONE)
+        st->endReason = SFX_END_MAX_DURATION;
+    if (collect)
+        st->seconds += timeSeconds() - startTime;
+#ifdef SFX_PROFILE
+    prof->samples += sampleCount - firstSample;
+#endif
+
+    return sampleCount - firstSample;
+}
+
+// Return sample count without any trailing silence.
+static int trimmedCount(const SfxSynth* synth)
+{
+    const SfxGenState* st = &synth->state;
+    if (st->endReason == SFX_END_SILENCE)
+        return st->lastLoud + 1;
+    return (st->sampleCount > 0) ? st->sampleCount : 0;
+}
+
+/*
+ * Synthesize wave data from parameters into synth->samples.
+ * A 44100Hz, mono channel wave is generated.
+ *
+ * If synth->silenceWindow is non-zero then generation stops once the
+ * samples have remained below synth->silenceLevel for that many samples,
+ * and the quiet samples at the end are excluded from the count.
+ *
+ * Return the number of samples generated.
+ */
+int sfx_generateWave(SfxSynth* synth, const SfxParams* sp)
+{
+    sfx_startWave(synth, sp);
+    sfx_generateBlock(synth, synth->samples.f,
+                      synth->sampleRate * synth->maxDuration);
+    return trimmedCount(synth);
+}
+
+/*
+ * Synthesize wave data like sfx_generateWave() and also fill the stats.
+ *
+ * Return the number of samples generated.
+ */
+int sfx_generateWaveStats(SfxSynth* synth, const SfxParams* sp,
+                          SfxStats* stats)
+{
+    sfx_startWave(synth, sp);
+    synth->state.collectStats = 1;
+    sfx_generateBlock(synth, synth->samples.f,
+                      synth->sampleRate * synth->maxDuration);
+    sfx_getStats(synth, stats);
+    return stats->trimCount;
+}
+
+/*
+ * Get the statistics of the samples generated since sfx_startWave().
+ * The peak, rms, dcOffset & seconds are only valid if
+ * synth->state.collectStats was set before the first sfx_generateBlock().
+ */
+void sfx_getStats(const SfxSynth* synth, SfxStats* stats)
+{
+    const SfxGenState* st = &synth->state;
+    int count = (st->sampleCount > 0) ? st->sampleCount : 0;
+
+    stats->peak        = st->peak;
+    stats->rms         = count ? (float) sqrt(st->sumSquares / count) : 0.0f;
+    stats->dcOffset    = count ? (float) (st->sum / count) : 0.0f;
+    stats->clipped     = st->clipped;
+    stats->sampleCount = count;
+    stats->trimCount   = trimmedCount(synth);
+    stats->endReason   = st->endReason;
+    stats->seconds     = st->seconds;
 }
 
 #ifndef CONFIG_SFX_NO_FILEIO
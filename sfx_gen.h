@@ -81,18 +81,150 @@ enum SfxSampleFormat {
     SFX_F32     // float
 };
 
+// Reason the generator stopped.
+enum SfxEndReason {
+    SFX_END_NONE,           // Sound is not finished
+    SFX_END_ENVELOPE,       // Volume envelope completed
+    SFX_END_MIN_FREQ,       // Frequency slid below minFrequency
+    SFX_END_MAX_DURATION,   // Limit of synth->maxDuration reached
+    SFX_END_SILENCE         // Quiet for synth->silenceWindow samples
+};
+
+// Statistics of the generated samples.  These are taken before the
+// samples are clamped, so peak may be greater than 1.0 when clipped is
+// non-zero.
+typedef struct SfxStats {
+    float peak;                 // Largest absolute sample value
+    float rms;                  // Root mean square of the samples
+    float dcOffset;             // Mean sample value
+    int clipped;                // Samples clamped to [-1..1]
+    int sampleCount;
+    int trimCount;              // Samples before any trailing silence
+    int endReason;              // SfxEndReason
+    double seconds;             // Time spent in sfx_generateBlock()
+}
+SfxStats;
+
+#ifdef SFX_FIXED_POINT
+// Filter, phaser & noise samples are Q24 fixed-point (1.0 is 1<<24) and
+// envVolume is Q16.
+typedef int32_t SfxSample;
+#else
+typedef float SfxSample;
+#endif
+
+// Generator state saved between sfx_generateBlock() calls.
+typedef struct SfxGenState {
+    SfxParams params;           // Copy of parameters passed to sfx_startWave
+    double fperiod;
+    double fmaxperiod;
+    double fslide;
+    double fdslide;
+    double arpeggioModulation;
+    float squareDuty;
+    float squareSlide;
+    SfxSample envVolume;
+    float fphase;
+    float fdphase;
+    SfxSample fltp;
+    SfxSample fltdp;
+    float fltw;
+    float fltwd;
+    float fltdmp;
+    SfxSample fltphp;
+    float flthp;
+    float flthpd;
+    float vibratoPhase;
+    float vibratoSpeed;
+    float vibratoAmplitude;
+    float minFreq;
+    float sslide;
+    int phase;
+    int period;
+    int envStage;
+    int envTime;
+    int envLength[3];
+    int iphase;
+    int ipp;
+    int repeatTime;
+    int repeatLimit;
+    int arpeggioTime;
+    int arpeggioLimit;
+    int pinkI;
+    uint32_t noiseCount;        // Position in the fast noise sequence
+    int ctlLeft;                // Samples until the next control update
+    float ctlPeriod;
+    float ctlPeriodStep;
+    float ctlDutyStep;
+    float ctlHpStep;
+    float ctlLpStep;
+#ifdef SFX_FIXED_POINT
+    float heldDuty;             // Duty & filter values used by the integer
+    float heldLpw;              // engine during a control period.
+    float heldHpw;
+#endif
+    int endReason;
+    int clipped;
+    int lastLoud;               // Last sample at or above silenceLevel
+    int collectStats;           // Set after sfx_startWave() to accumulate
+    float peak;                 // the peak, sums & seconds.
+    double sum;
+    double sumSquares;
+    double seconds;
+    int sampleCount;            // Samples generated so far
+    int sampleEnd;              // Sample limit (reduced when the sound ends)
+}
+SfxGenState;
+
+#ifdef SFX_PROFILE
+// Stages of sfx_generateBlock() timed when SFX_PROFILE is defined.
+enum SfxProfileStage {
+    SFX_PROF_SETUP,         // Parameter setup in the first block
+    SFX_PROF_PITCH,         // Repeat, arpeggio, slide & duty sweep
+    SFX_PROF_VIBRATO,
+    SFX_PROF_ENVELOPE,
+    SFX_PROF_OSCILLATOR,
+    SFX_PROF_NOISE,         // Noise buffer refills
+    SFX_PROF_FILTER,        // Low-pass & high-pass filters
+    SFX_PROF_PHASER,
+    SFX_PROF_OUTPUT,        // Clamp & sample format conversion
+    SFX_PROF_COUNT
+};
+
+// Counters for the sound begun by the last sfx_startWave().
+typedef struct SfxProfile {
+    uint64_t ticks[SFX_PROF_COUNT]; // CPU cycles (or ns if unavailable)
+    uint32_t samples;
+    uint32_t noiseRefills;
+    uint32_t envTransitions;
+    uint32_t repeatResets;
+    uint32_t clamps;                // Output samples clipped to [-1..1]
+}
+SfxProfile;
+#endif
+
 typedef struct SfxSynth {
     int sampleFormat;
     int sampleRate;             // Must be 44100 for now
     int maxDuration;            // Length in seconds
+    float silenceLevel;         // Stop when samples stay below this level
+    int silenceWindow;          // for this many samples (0 disables)
+    int controlRate;            // Samples between slide & sweep updates
+                                // (0 updates every sample)
+    int fastNoise;              // Use the internal noise generator rather
+                                // than sfx_random() (not the reference)
     union {
         uint8_t* u8;
         int16_t* i16;
         float*   f;
     } samples;                  // sampleRate * maxDuration
-    float noiseBuffer[32];      // Random values for SFX_NOISE/SFX_PINK_NOISE
-    float pinkWhiteValue[5];    // SFX_PINK_NOISE
-    float phaserBuffer[1024];
+    SfxGenState state;
+    SfxSample noiseBuffer[32];  // Random values for SFX_NOISE/SFX_PINK_NOISE
+    SfxSample pinkWhiteValue[5];    // SFX_PINK_NOISE
+    SfxSample phaserBuffer[1024];
+#ifdef SFX_PROFILE
+    SfxProfile profile;
+#endif
 }
 SfxSynth;
 
@@ -103,6 +235,10 @@ extern "C" {
 void sfx_resetParams(SfxParams *params);
 SfxSynth* sfx_allocSynth(int format, int sampleRate, int maxDuration);
 int sfx_generateWave(SfxSynth*, const SfxParams* params);
+void sfx_startWave(SfxSynth*, const SfxParams* params);
+int sfx_generateBlock(SfxSynth*, void* buffer, int sampleCount);
+int sfx_generateWaveStats(SfxSynth*, const SfxParams* params, SfxStats*);
+void sfx_getStats(const SfxSynth*, SfxStats*);
 
 // Load/Save functions
 const char* sfx_loadParams(SfxParams *params, const char *fileName,
@@ -121,6 +257,10 @@ void sfx_genSynth(SfxParams*);
 void sfx_genRandomize(SfxParams*, int waveType);
 void sfx_mutate(SfxParams *params, float range, uint32_t mask);
 
+#ifdef SFX_PROFILE
+const char* sfx_profileStageName(int stage);
+#endif
+
 #ifdef __cplusplus
 }
 #endif
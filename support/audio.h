@@ -13,9 +13,17 @@
 extern "C" {
 #endif
 
+/*
+  Stream fill function.  Write up to frameCount frames of float samples
+  and return the number written.  Returning less than frameCount ends the
+  stream once the queued data has played.
+*/
+typedef int (*AudStreamFunc)(void* user, float* samples, int frameCount);
+
 int  aud_startup();
 void aud_shutdown();
 void aud_stopAll();
+void aud_stopSounds();
 void aud_pauseProcessing(int paused);
 void aud_genBuffers(int count, uint32_t* ids);
 void aud_freeBuffers(int count, uint32_t* ids);
@@ -24,8 +32,17 @@ int  aud_loadBufferI16(uint32_t bufId, const int16_t* samples, int sampleCount,
 int  aud_loadBufferF32(uint32_t bufId, const float* samples, int sampleCount,
                        int stereo, int freq);
 uint32_t aud_playSound(uint32_t bufferId);
+uint32_t aud_playSoundAt(uint32_t bufferId, uint64_t frame);
 void aud_stopSound(uint32_t sourceId);
 void aud_setSoundVolume(float);
+uint64_t aud_clock();
+uint32_t aud_startStream(AudStreamFunc func, void* user, int stereo, int freq);
+uint32_t aud_startStreamAt(AudStreamFunc func, void* user, int stereo,
+                           int freq, uint64_t frame);
+void aud_stopStream(uint32_t streamId);
+int  aud_streamPlaying(uint32_t streamId);
+int  aud_streamUnderruns(uint32_t streamId);
+int  aud_exactTiming();
 
 #ifdef __cplusplus
 }
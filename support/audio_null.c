@@ -0,0 +1,754 @@
+/*
+  Audio Module - Headless Backend
+  Copyright 2005-2012,2022 Karl Robillard
+
+  Permission is hereby granted, free of charge, to any person obtaining a
+  copy of this software and associated documentation files (the "Software"),
+  to deal in the Software without restriction, including without limitation
+  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+  and/or sell copies of the Software, and to permit persons to whom the
+  Software is furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in
+  all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+  DEALINGS IN THE SOFTWARE.
+*/
+
+/*
+  This backend needs no sound device.  Buffers are kept in memory and
+  mixed in software to a stereo output which is either discarded (null
+  device) or written to a WAVE file (file sink).
+
+  Time advances at a multiple of real time on a mixer thread, or only when
+  aud_advance() is called if the rate passed to aud_configureHeadless() is
+  zero.  The latter gives deterministic results for testing & benchmarks.
+
+  Buffers are played at the output rate; no resampling is done.
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#include "audio_null.h"
+
+
+#define FX_COUNT        4
+#define STREAM_COUNT    8
+#define STREAM_FRAMES   1024
+#define MIX_FRAMES      512
+
+enum AudioState
+{
+    AUDIO_DOWN,
+    AUDIO_UP,
+    AUDIO_THREAD_UP
+};
+
+typedef struct
+{
+    float* data;
+    int frames;
+    int stereo;
+}
+NullBuffer;
+
+typedef struct
+{
+    uint64_t start;     // Output clock time to begin playing.
+    uint32_t bufId;
+    int pos;
+}
+NullSource;
+
+typedef struct
+{
+    uint64_t start;     // Output clock time to begin playing.
+    AudStreamFunc func;
+    void* user;
+    int stereo;
+    int avail;          // Frames in block.
+    int pos;            // Frames of block already mixed.
+    int ended;
+    float block[ STREAM_FRAMES * 2 ];
+}
+NullStream;
+
+static int _audioUp = AUDIO_DOWN;
+static int _paused = 0;
+static int _outFreq = 44100;
+static double _rate = 1.0;
+static char* _wavFile = NULL;
+static FILE* _wavFp = NULL;
+static uint32_t _wavBytes = 0;
+static uint64_t _clock = 0;         // Frames mixed since startup.
+static float _gain = 1.0f;
+
+static NullBuffer* _buffers = NULL;
+static int _bufferAvail = 0;
+static NullSource _source[ FX_COUNT ];
+static NullStream _stream[ STREAM_COUNT ];
+static float   _mix[ MIX_FRAMES * 2 ];
+static int16_t _pcm[ MIX_FRAMES * 2 ];
+static AudioTiming _timing[ AUD_TIMING_COUNT ];
+
+static pthread_t _mixThread;
+static pthread_mutex_t _mutex = PTHREAD_MUTEX_INITIALIZER;
+static volatile int _mixQuit = 0;
+
+
+static double timeNow()
+{
+#ifdef _WIN32
+    LARGE_INTEGER freq, count;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&count);
+    return (double) count.QuadPart / (double) freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+#endif
+}
+
+
+static void timingAdd(int id, double start, int samples)
+{
+    AudioTiming* tm = _timing + id;
+    double elapsed = timeNow() - start;
+    ++tm->calls;
+    tm->samples += samples;
+    tm->seconds += elapsed;
+    if (tm->maxSeconds < elapsed)
+        tm->maxSeconds = elapsed;
+}
+
+
+static void sleepSec(double sec)
+{
+#ifdef _WIN32
+    Sleep((DWORD) (sec * 1000.0));
+#else
+    struct timespec ts;
+    ts.tv_sec  = (time_t) sec;
+    ts.tv_nsec = (long) ((sec - (double) ts.tv_sec) * 1e9);
+    nanosleep(&ts, NULL);
+#endif
+}
+
+
+#define WRITE_32(N) \
+    dword = N; \
+    fwrite(&dword, 1, 4, fp)
+
+#define WRITE_16(N) \
+    word = N; \
+    fwrite(&word, 1, 2, fp)
+
+// Write 16-bit stereo WAVE header.  It is written again with the correct
+// sizes when the file is closed.
+static void writeWaveHeader(FILE* fp, uint32_t dataSize)
+{
+    uint32_t dword;
+    uint16_t word;
+
+    fwrite("RIFF", 1, 4, fp);
+    WRITE_32(36 + dataSize);
+    fwrite("WAVEfmt ", 1, 8, fp);
+    WRITE_32(16);                   // Chunk size
+    WRITE_16(1);                    // Compression code
+    WRITE_16(2);                    // Channels
+    WRITE_32(_outFreq);             // Sample rate
+    WRITE_32(_outFreq * 4);         // Bytes/sec
+    WRITE_16(4);                    // Block align
+    WRITE_16(16);                   // Bits per sample
+    fwrite("data", 1, 4, fp);
+    WRITE_32(dataSize);
+}
+
+
+// Add frames from interleaved samples to the mix.
+static void mixFrames(float* out, const float* src, int frames, int stereo)
+{
+    float* end = out + frames * 2;
+    if (stereo) {
+        for (; out != end; out += 2, src += 2) {
+            out[0] += src[0];
+            out[1] += src[1];
+        }
+    } else {
+        for (; out != end; out += 2, ++src) {
+            out[0] += src[0];
+            out[1] += src[0];
+        }
+    }
+}
+
+
+// Mix one block of frames.  The caller must hold _mutex.
+static void mixBlock(int frames)
+{
+    NullSource* src;
+    NullStream* st;
+    const NullBuffer* buf;
+    double start, fillStart;
+    float* out;
+    uint64_t blockEnd = _clock + frames;
+    int i, n, left, offset;
+
+    start = timeNow();
+    memset(_mix, 0, frames * 2 * sizeof(float));
+
+    // Scheduled sounds begin at an offset inside the block.
+#define START_OFFSET(T) (((T) > _clock) ? (int) ((T) - _clock) : 0)
+
+    for (i = 0; i < FX_COUNT; ++i) {
+        src = _source + i;
+        if (! src->bufId || src->start >= blockEnd)
+            continue;
+        offset = START_OFFSET(src->start);
+        buf = _buffers + src->bufId - 1;
+        n = buf->frames - src->pos;
+        if (n > frames - offset)
+            n = frames - offset;
+        mixFrames(_mix + offset * 2,
+                  buf->data + src->pos * (buf->stereo ? 2 : 1),
+                  n, buf->stereo);
+        src->pos += n;
+        if (src->pos >= buf->frames)
+            src->bufId = 0;
+    }
+
+    for (i = 0; i < STREAM_COUNT; ++i) {
+        st = _stream + i;
+        if (! st->func || st->start >= blockEnd)
+            continue;
+        offset = START_OFFSET(st->start);
+        out = _mix + offset * 2;
+        left = frames - offset;
+        while (st->func && left) {
+            if (st->pos == st->avail) {
+                if (st->ended) {
+                    st->func = NULL;
+                    break;
+                }
+                fillStart = timeNow();
+                st->avail = st->func(st->user, st->block, STREAM_FRAMES);
+                timingAdd(AUD_TIMING_STREAM, fillStart, st->avail);
+                st->pos = 0;
+                if (st->avail < STREAM_FRAMES)
+                    st->ended = 1;
+                continue;
+            }
+            n = st->avail - st->pos;
+            if (n > left)
+                n = left;
+            mixFrames(out, st->block + st->pos * (st->stereo ? 2 : 1),
+                      n, st->stereo);
+            st->pos += n;
+            out += n * 2;
+            left -= n;
+        }
+    }
+
+    if (_gain != 1.0f) {
+        for (i = 0; i < frames * 2; ++i)
+            _mix[i] *= _gain;
+    }
+    timingAdd(AUD_TIMING_MIX, start, frames);
+
+    if (_wavFp) {
+        float v;
+        start = timeNow();
+        for (i = 0; i < frames * 2; ++i) {
+            v = _mix[i];
+            if (v > 1.0f)
+                v = 1.0f;
+            else if (v < -1.0f)
+                v = -1.0f;
+            _pcm[i] = (int16_t) (v * 32767.0f);
+        }
+        _wavBytes += fwrite(_pcm, 1, frames * 4, _wavFp);
+        timingAdd(AUD_TIMING_WRITE, start, frames);
+    }
+
+    _clock += frames;
+}
+
+
+static void* mixThread(void* arg)
+{
+    double blockSec = (double) MIX_FRAMES / _outFreq / _rate;
+    double next = timeNow();
+    double now;
+    (void) arg;
+
+    while (! _mixQuit) {
+        pthread_mutex_lock(&_mutex);
+        if (! _paused)
+            mixBlock(MIX_FRAMES);
+        pthread_mutex_unlock(&_mutex);
+
+        next += blockSec;
+        now = timeNow();
+        if (next > now)
+            sleepSec(next - now);
+        else
+            next = now;
+    }
+    return NULL;
+}
+
+
+/**
+  Set the headless output.  This must be called before aud_startup().
+
+  \param freq       Output sample rate.
+  \param rate       Multiple of real time to mix at.  If zero, the output
+                    only advances when aud_advance() is called.
+  \param wavFile    Path of WAVE file to write the mix to, or NULL to
+                    discard it.
+*/
+void aud_configureHeadless(int freq, double rate, const char* wavFile)
+{
+    _outFreq = freq;
+    _rate = rate;
+    free(_wavFile);
+    _wavFile = NULL;
+    if (wavFile) {
+        _wavFile = (char*) malloc(strlen(wavFile) + 1);
+        strcpy(_wavFile, wavFile);
+    }
+}
+
+
+/**
+  Mix frames on the calling thread.  This is only for use when the rate
+  passed to aud_configureHeadless() is zero.
+*/
+void aud_advance(int frames)
+{
+    int n;
+    if (_audioUp != AUDIO_UP)
+        return;
+    pthread_mutex_lock(&_mutex);
+    while (frames > 0 && ! _paused) {
+        n = (frames < MIX_FRAMES) ? frames : MIX_FRAMES;
+        mixBlock(n);
+        frames -= n;
+    }
+    pthread_mutex_unlock(&_mutex);
+}
+
+
+/**
+  Return timing statistics for one operation type (AUD_TIMING_LOAD, etc.).
+*/
+const AudioTiming* aud_timing(int id)
+{
+    return (id >= 0 && id < AUD_TIMING_COUNT) ? _timing + id : NULL;
+}
+
+
+void aud_resetTimings()
+{
+    pthread_mutex_lock(&_mutex);
+    memset(_timing, 0, sizeof(_timing));
+    pthread_mutex_unlock(&_mutex);
+}
+
+
+/**
+  Called once at program startup.
+  Returns 0 on a fatal error.
+*/
+int aud_startup()
+{
+    if (_wavFile) {
+        _wavFp = fopen(_wavFile, "wb");
+        if (! _wavFp)
+            return 0;
+        writeWaveHeader(_wavFp, 0);
+        _wavBytes = 0;
+    }
+
+    memset(_source, 0, sizeof(_source));
+    memset(_stream, 0, sizeof(_stream));
+    memset(_timing, 0, sizeof(_timing));
+    _clock = 0;
+    _audioUp = AUDIO_UP;
+
+    if (_rate > 0.0) {
+        _mixQuit = 0;
+        if (pthread_create(&_mixThread, NULL, mixThread, NULL) == 0)
+            _audioUp = AUDIO_THREAD_UP;
+    }
+    return 1;
+}
+
+
+/**
+  Called once when program exits.
+  It is safe to call this even if aud_startup() was not called.
+*/
+void aud_shutdown()
+{
+    int i;
+
+    if (_audioUp == AUDIO_THREAD_UP) {
+        _mixQuit = 1;
+        pthread_join(_mixThread, NULL);
+    }
+    _audioUp = AUDIO_DOWN;
+
+    if (_wavFp) {
+        fseek(_wavFp, 0, SEEK_SET);
+        writeWaveHeader(_wavFp, _wavBytes);
+        fclose(_wavFp);
+        _wavFp = NULL;
+    }
+
+    for (i = 0; i < _bufferAvail; ++i)
+        free(_buffers[i].data);
+    free(_buffers);
+    _buffers = NULL;
+    _bufferAvail = 0;
+}
+
+
+void aud_stopAll()
+{
+    pthread_mutex_lock(&_mutex);
+    memset(_source, 0, sizeof(_source));
+    memset(_stream, 0, sizeof(_stream));
+    pthread_mutex_unlock(&_mutex);
+}
+
+
+/**
+  Stop all sounds started with aud_playSound() but leave streams playing.
+*/
+void aud_stopSounds()
+{
+    pthread_mutex_lock(&_mutex);
+    memset(_source, 0, sizeof(_source));
+    pthread_mutex_unlock(&_mutex);
+}
+
+
+/**
+  Call to stop (or later resume) processing audio.
+*/
+void aud_pauseProcessing(int paused)
+{
+    _paused = paused;
+}
+
+
+void aud_genBuffers(int count, uint32_t* ids)
+{
+    NullBuffer* buf;
+    int i, n;
+
+    pthread_mutex_lock(&_mutex);
+    for (i = 0; i < _bufferAvail && count; ++i) {
+        buf = _buffers + i;
+        if (buf->frames < 0) {
+            buf->frames = 0;
+            *ids++ = i + 1;
+            --count;
+        }
+    }
+    if (count) {
+        n = _bufferAvail + count;
+        buf = (NullBuffer*) realloc(_buffers, n * sizeof(NullBuffer));
+        if (buf) {
+            _buffers = buf;
+            for (i = _bufferAvail; i < n; ++i) {
+                _buffers[i].data = NULL;
+                _buffers[i].frames = 0;
+                _buffers[i].stereo = 0;
+                *ids++ = i + 1;
+            }
+            _bufferAvail = n;
+        } else {
+            while (count--)
+                *ids++ = 0;
+        }
+    }
+    pthread_mutex_unlock(&_mutex);
+}
+
+
+void aud_freeBuffers(int count, uint32_t* ids)
+{
+    NullBuffer* buf;
+    uint32_t id;
+    int i;
+
+    pthread_mutex_lock(&_mutex);
+    for (; count; --count) {
+        id = *ids++;
+        if (id && id <= (uint32_t) _bufferAvail) {
+            for (i = 0; i < FX_COUNT; ++i) {
+                if (_source[i].bufId == id)
+                    _source[i].bufId = 0;
+            }
+            buf = _buffers + id - 1;
+            free(buf->data);
+            buf->data = NULL;
+            buf->frames = -1;       // Mark as unused.
+        }
+    }
+    pthread_mutex_unlock(&_mutex);
+}
+
+
+// Return buffer storage for sampleCount samples.  The caller must hold
+// _mutex.
+static float* bufferStorage(uint32_t bufId, int sampleCount, int stereo)
+{
+    NullBuffer* buf;
+    float* data;
+    int i;
+
+    if (! bufId || bufId > (uint32_t) _bufferAvail)
+        return NULL;
+
+    // Any source playing the buffer is stopped, as with OpenAL.
+    for (i = 0; i < FX_COUNT; ++i) {
+        if (_source[i].bufId == bufId)
+            _source[i].bufId = 0;
+    }
+
+    buf = _buffers + bufId - 1;
+    data = (float*) realloc(buf->data, sampleCount * sizeof(float));
+    if (! data)
+        return NULL;
+    buf->data = data;
+    buf->stereo = stereo;
+    buf->frames = stereo ? sampleCount / 2 : sampleCount;
+    return data;
+}
+
+
+int aud_loadBufferI16(uint32_t bufId, const int16_t* samples, int sampleCount,
+                      int stereo, int freq)
+{
+    double start = timeNow();
+    float* data;
+    int i, ok = 0;
+    (void) freq;
+
+    pthread_mutex_lock(&_mutex);
+    data = bufferStorage(bufId, sampleCount, stereo);
+    if (data) {
+        for (i = 0; i < sampleCount; ++i)
+            data[i] = (float) samples[i] * (1.0f / 32767.0f);
+        ok = 1;
+    }
+    timingAdd(AUD_TIMING_LOAD, start, sampleCount);
+    pthread_mutex_unlock(&_mutex);
+    return ok;
+}
+
+
+int aud_loadBufferF32(uint32_t bufId, const float* samples, int sampleCount,
+                      int stereo, int freq)
+{
+    double start = timeNow();
+    float* data;
+    int ok = 0;
+    (void) freq;
+
+    pthread_mutex_lock(&_mutex);
+    data = bufferStorage(bufId, sampleCount, stereo);
+    if (data) {
+        memcpy(data, samples, sampleCount * sizeof(float));
+        ok = 1;
+    }
+    timingAdd(AUD_TIMING_LOAD, start, sampleCount);
+    pthread_mutex_unlock(&_mutex);
+    return ok;
+}
+
+
+/*
+  Return the output clock in frames at the output sample rate.
+  The clock starts at zero when aud_startup() is called.
+*/
+uint64_t aud_clock()
+{
+    uint64_t clock;
+    pthread_mutex_lock(&_mutex);
+    clock = _clock;
+    pthread_mutex_unlock(&_mutex);
+    return clock;
+}
+
+
+/*
+  \return source Id.
+*/
+uint32_t aud_playSound(uint32_t bufferId)
+{
+    return aud_playSoundAt(bufferId, 0);
+}
+
+
+/*
+  Play a buffer starting at a given time.
+
+  \param frame  Output clock time (see aud_clock()) to start playing.
+                If the time has already passed the sound plays immediately.
+
+  \return source Id.
+*/
+uint32_t aud_playSoundAt(uint32_t bufferId, uint64_t frame)
+{
+    static int sn = 0;
+    uint32_t id = 0;
+
+    pthread_mutex_lock(&_mutex);
+    if (_audioUp && bufferId && bufferId <= (uint32_t) _bufferAvail &&
+        _buffers[bufferId - 1].frames > 0) {
+        NullSource* src = _source + sn;
+        id = sn + 1;
+        ++sn;
+        if (sn == FX_COUNT)
+            sn = 0;
+
+        src->start = frame;
+        src->bufId = bufferId;
+        src->pos = 0;
+    }
+    pthread_mutex_unlock(&_mutex);
+    return id;
+}
+
+
+void aud_stopSound(uint32_t sourceId)
+{
+    if (sourceId && sourceId <= FX_COUNT) {
+        pthread_mutex_lock(&_mutex);
+        _source[sourceId - 1].bufId = 0;
+        pthread_mutex_unlock(&_mutex);
+    }
+}
+
+
+/*
+  \param vol    0.0 to 1.0
+*/
+void aud_setSoundVolume(float vol)
+{
+    _gain = vol;
+}
+
+
+//----------------------------------------------------------------------------
+// Streaming sources
+
+
+/*
+  Begin playing a stream source.  The fill function is called from the
+  mixer (the thread calling aud_advance() or the mixer thread).
+
+  \return Stream Id or zero if no stream is available.
+*/
+uint32_t aud_startStream(AudStreamFunc func, void* user, int stereo, int freq)
+{
+    return aud_startStreamAt(func, user, stereo, freq, 0);
+}
+
+
+/*
+  Begin playing a stream source at a given time.
+
+  \param frame  Output clock time (see aud_clock()) to start playing.
+
+  \return Stream Id or zero if no stream is available.
+*/
+uint32_t aud_startStreamAt(AudStreamFunc func, void* user, int stereo,
+                           int freq, uint64_t frame)
+{
+    NullStream* st;
+    uint32_t id = 0;
+    int i;
+    (void) freq;
+
+    if (! _audioUp)
+        return 0;
+
+    pthread_mutex_lock(&_mutex);
+    for (i = 0; i < STREAM_COUNT; ++i) {
+        st = _stream + i;
+        if (! st->func) {
+            st->start = frame;
+            st->func = func;
+            st->user = user;
+            st->stereo = stereo;
+            st->avail = st->pos = 0;
+            st->ended = 0;
+            id = i + 1;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&_mutex);
+    return id;
+}
+
+
+void aud_stopStream(uint32_t streamId)
+{
+    if (streamId && streamId <= STREAM_COUNT) {
+        pthread_mutex_lock(&_mutex);
+        _stream[ streamId - 1 ].func = NULL;
+        pthread_mutex_unlock(&_mutex);
+    }
+}
+
+
+int aud_streamPlaying(uint32_t streamId)
+{
+    if (streamId && streamId <= STREAM_COUNT)
+        return _stream[ streamId - 1 ].func != NULL;
+    return 0;
+}
+
+
+/*
+  The software mixer always fills streams on demand so underruns
+  cannot occur.
+*/
+int aud_streamUnderruns(uint32_t streamId)
+{
+    (void) streamId;
+    return 0;
+}
+
+
+/*
+  Scheduled starts are always sample accurate as the mixer applies them.
+*/
+int aud_exactTiming()
+{
+    return 1;
+}
+
+
+//EOF
@@ -0,0 +1,46 @@
+#ifndef AUDIO_NULL_H
+#define AUDIO_NULL_H
+/*
+  Audio Module - Headless Backend Extensions
+  Copyright 2005-2012,2022 Karl Robillard
+
+  This code may be used under the terms of the MIT license (see audio_null.c).
+
+  These functions exist only in audio_null.c.
+*/
+
+#include "audio.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Operation timings kept by the headless backend.
+enum AudioTimingId
+{
+    AUD_TIMING_LOAD,    // aud_loadBuffer* calls
+    AUD_TIMING_MIX,     // Mixing of each output block
+    AUD_TIMING_STREAM,  // Stream fill function calls
+    AUD_TIMING_WRITE,   // Output file writes
+    AUD_TIMING_COUNT
+};
+
+typedef struct
+{
+    uint32_t calls;
+    uint64_t samples;   // Total samples (or frames) processed
+    double seconds;     // Total elapsed time
+    double maxSeconds;  // Longest single call
+}
+AudioTiming;
+
+void aud_configureHeadless(int freq, double rate, const char* wavFile);
+void aud_advance(int frames);
+const AudioTiming* aud_timing(int id);
+void aud_resetTimings();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* AUDIO_NULL_H */
@@ -24,6 +24,13 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
 
 #ifdef __APPLE__
 #include <OpenAL/al.h>
@@ -35,13 +42,39 @@
 #include <AL/alext.h>
 #endif
 
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define CONVERT_SSE2
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define CONVERT_NEON
+#endif
+
 #include "audio.h"
 
+#ifndef AL_FORMAT_MONO_FLOAT32
+#define AL_FORMAT_MONO_FLOAT32      0x10010
+#define AL_FORMAT_STEREO_FLOAT32    0x10011
+#endif
+
+#ifndef ALC_DEVICE_CLOCK_SOFT
+#define ALC_DEVICE_CLOCK_SOFT       0x1600
+#endif
+
+// ALC_SOFT_device_clock & AL_SOFT_source_start_delay functions.
+typedef void (*DeviceClockFunc)(ALCdevice*, ALCenum, ALsizei, int64_t*);
+typedef void (*PlayAtTimeFunc)(ALuint, int64_t);
+
 
 #define FX_COUNT        4
 #define AMBIENT_COUNT   0
 #define SOURCE_COUNT    FX_COUNT + AMBIENT_COUNT
 
+#define STREAM_COUNT    8
+#define STREAM_BUFFERS  4
+#define STREAM_FRAMES   1024    // Frames per buffer (23ms at 44100 Hz)
+#define STREAM_POLL_MS  5
+
 enum AudioState
 {
     AUDIO_DOWN,
@@ -54,6 +87,66 @@ static ALCdevice*  _adevice  = 0;
 static ALCcontext* _acontext = 0;
 static ALuint _asource[ SOURCE_COUNT ];
 
+enum StreamState
+{
+    STREAM_IDLE,
+    STREAM_PLAYING,     // Fill function is being called.
+    STREAM_DRAINING     // Fill function has ended; waiting for queue to empty.
+};
+
+typedef struct
+{
+    AudStreamFunc func;
+    void* user;
+    ALuint source;
+    ALuint buf[ STREAM_BUFFERS ];
+    int state;
+    int primed;         // Number of buffers which have been queued once.
+    int stereo;
+    int freq;
+    int underruns;
+    int delay;          // Frames of silence to emit before calling func.
+}
+AudioStream;
+
+typedef struct
+{
+    uint64_t frame;     // Output clock time to begin playing.
+    int pending;
+}
+ScheduledPlay;
+
+static AudioStream _stream[ STREAM_COUNT ];
+static float   _streamBlock[ STREAM_FRAMES * 2 ];
+static int16_t _streamPcm[ STREAM_FRAMES * 2 ];
+static pthread_t _streamThread;
+static pthread_mutex_t _streamMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t _workerMutex = PTHREAD_MUTEX_INITIALIZER;
+static volatile int _streamQuit = 0;
+static ScheduledPlay _scheduled[ FX_COUNT ];
+static DeviceClockFunc _deviceClock = 0;
+static PlayAtTimeFunc  _playAtTime = 0;
+static int _deviceFreq = 44100;
+static double _startTime;
+static int _floatFormat = 0;            // AL_EXT_FLOAT32 is available.
+static int16_t* _convBuf = 0;           // Scratch buffer for conversion.
+static int _convAvail = 0;              // Number of samples in _convBuf.
+
+
+static double timeNow()
+{
+#ifdef _WIN32
+    LARGE_INTEGER freq, count;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&count);
+    return (double) count.QuadPart / (double) freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+#endif
+}
+
 
 /**
   Called once at program startup.
@@ -61,6 +154,8 @@ static ALuint _asource[ SOURCE_COUNT ];
 */
 int aud_startup()
 {
+    int i;
+
     _adevice = alcOpenDevice(0);
     if (! _adevice)
         return 0;
@@ -69,6 +164,28 @@ int aud_startup()
 
     alGenSources(SOURCE_COUNT, _asource);
 
+    for (i = 0; i < STREAM_COUNT; ++i) {
+        AudioStream* st = _stream + i;
+        alGenSources(1, &st->source);
+        alGenBuffers(STREAM_BUFFERS, st->buf);
+        st->state = STREAM_IDLE;
+    }
+
+    _floatFormat = alIsExtensionPresent("AL_EXT_FLOAT32") ? 1 : 0;
+
+    // Use the device clock and start delay extensions for scheduled plays
+    // if available.
+    alcGetIntegerv(_adevice, ALC_FREQUENCY, 1, &_deviceFreq);
+    if (_deviceFreq <= 0)
+        _deviceFreq = 44100;
+    if (alcIsExtensionPresent(_adevice, "ALC_SOFT_device_clock"))
+        _deviceClock = (DeviceClockFunc)
+            alcGetProcAddress(_adevice, "alcGetInteger64vSOFT");
+    if (_deviceClock && alIsExtensionPresent("AL_SOFT_source_start_delay"))
+        _playAtTime = (PlayAtTimeFunc)
+            alGetProcAddress("alSourcePlayAtTimeSOFT");
+    _startTime = timeNow();
+
     _audioUp = AUDIO_AL_UP;
     return 1;
 }
@@ -81,12 +198,48 @@ int aud_startup()
 void aud_shutdown()
 {
     if (_audioUp) {
+        int i;
+
+        if (_audioUp == AUDIO_THREAD_UP) {
+            _streamQuit = 1;
+            pthread_join(_streamThread, NULL);
+            _streamQuit = 0;
+        }
+
+        for (i = 0; i < STREAM_COUNT; ++i) {
+            AudioStream* st = _stream + i;
+            alSourceStop(st->source);
+            alSourcei(st->source, AL_BUFFER, 0);
+            alDeleteSources(1, &st->source);
+            alDeleteBuffers(STREAM_BUFFERS, st->buf);
+            st->state = STREAM_IDLE;
+        }
+
         alDeleteSources(SOURCE_COUNT, _asource);
         alcDestroyContext(_acontext);
         alcCloseDevice(_adevice);
 
         _audioUp = AUDIO_DOWN;
     }
+
+    free(_convBuf);
+    _convBuf = 0;
+    _convAvail = 0;
+}
+
+
+static void stream_release(AudioStream*);
+
+// The caller must hold _streamMutex.
+static void stopSources()
+{
+    ALuint i;
+    for (i = 0; i < SOURCE_COUNT; ++i) {
+        alSourceStop(_asource[i]);
+        alSourcei(_asource[i], AL_BUFFER, 0);
+    }
+    for (i = 0; i < FX_COUNT; ++i)
+        _scheduled[i].pending = 0;
 }
 
 
@@ -94,10 +247,27 @@ void aud_stopAll()
 {
     if (_audioUp) {
         ALuint i;
-        for (i = 0; i < SOURCE_COUNT; ++i) {
-            alSourceStop(_asource[i]);
-            alSourcei(_asource[i], AL_BUFFER, 0);
+
+        pthread_mutex_lock(&_streamMutex);
+        stopSources();
+        for (i = 0; i < STREAM_COUNT; ++i) {
+            if (_stream[i].state != STREAM_IDLE)
+                stream_release(_stream + i);
         }
+        pthread_mutex_unlock(&_streamMutex);
+    }
+}
+
+
+/**
+  Stop all sounds started with aud_playSound() but leave streams playing.
+*/
+void aud_stopSounds()
+{
+    if (_audioUp) {
+        pthread_mutex_lock(&_streamMutex);
+        stopSources();
+        pthread_mutex_unlock(&_streamMutex);
     }
 }
 
@@ -134,28 +304,86 @@ int aud_loadBufferI16(uint32_t bufId, const int16_t* samples, int sampleCount,
 }
 
 
+/*
+  Convert float samples (-1.0 to 1.0) to int16_t (-32767 to 32767).
+  The float to integer conversion truncates, as does a C cast.
+*/
+static void convertF32toI16(int16_t* dst, const float* src, int count)
+{
+    const float* send = src + count;
+#if defined(CONVERT_SSE2)
+    const __m128 scale = _mm_set1_ps(32767.0f);
+    __m128i a, b;
+    for (; count >= 8; count -= 8) {
+        a = _mm_cvttps_epi32(_mm_mul_ps(_mm_loadu_ps(src),     scale));
+        b = _mm_cvttps_epi32(_mm_mul_ps(_mm_loadu_ps(src + 4), scale));
+        _mm_storeu_si128((__m128i*) dst, _mm_packs_epi32(a, b));
+        src += 8;
+        dst += 8;
+    }
+#elif defined(CONVERT_NEON)
+    const float32x4_t scale = vdupq_n_f32(32767.0f);
+    int32x4_t a, b;
+    for (; count >= 8; count -= 8) {
+        a = vcvtq_s32_f32(vmulq_f32(vld1q_f32(src),     scale));
+        b = vcvtq_s32_f32(vmulq_f32(vld1q_f32(src + 4), scale));
+        vst1q_s16(dst, vcombine_s16(vqmovn_s32(a), vqmovn_s32(b)));
+        src += 8;
+        dst += 8;
+    }
+#endif
+    for (; src != send; ++src)
+        *dst++ = (int16_t) (src[0] * 32767.0f);
+}
+
+
+/*
+  Load float samples into a buffer.  If the AL_EXT_FLOAT32 extension is
+  not present the samples are converted to 16-bit PCM in the pcm array,
+  which must have room for sampleCount values.
+*/
+static ALenum bufferDataF32(ALuint bufId, const float* samples,
+                            int sampleCount, int stereo, int freq,
+                            int16_t* pcm)
+{
+    if (_floatFormat) {
+        alBufferData(bufId, stereo ? AL_FORMAT_STEREO_FLOAT32
+                                   : AL_FORMAT_MONO_FLOAT32,
+                     samples, sampleCount * sizeof(float), freq);
+    } else {
+        convertF32toI16(pcm, samples, sampleCount);
+        alBufferData(bufId, stereo ? AL_FORMAT_STEREO16 : AL_FORMAT_MONO16,
+                     pcm, sampleCount * sizeof(int16_t), freq);
+    }
+    return alGetError();
+}
+
+
+/*
+  Load float samples into a buffer.  The samples are passed directly to
+  OpenAL if possible, otherwise they are converted using a scratch buffer
+  which is kept between calls.
+*/
 int aud_loadBufferF32(uint32_t bufId, const float* samples, int sampleCount,
                       int stereo, int freq)
 {
     if (_audioUp) {
-        const float* send = samples + sampleCount;
-        int16_t* pcm;
-        int16_t* it;
         ALenum err;
-        ALenum format = stereo ? AL_FORMAT_STEREO16 : AL_FORMAT_MONO16;
-                              // AL_FORMAT_STEREO8  : AL_FORMAT_MONO8;
-        ALsizei bytes = sampleCount * sizeof(int16_t);
-
-        it = pcm = (int16_t*) malloc(bytes);
-        if (pcm) {
-            for (; samples != send; ++samples)
-                *it++ = (int16_t) (samples[0] * 32767.0f);  // -32768 to 32767.
 
-            alBufferData(bufId, format, pcm, bytes, freq);
-            free(pcm);
+        if (! _floatFormat && sampleCount > _convAvail) {
+            int16_t* pcm = (int16_t*)
+                realloc(_convBuf, sampleCount * sizeof(int16_t));
+            if (! pcm) {
+                fprintf(stderr, "ERROR: aud_loadBufferF32 out of memory");
+                return 0;
+            }
+            _convBuf = pcm;
+            _convAvail = sampleCount;
         }
 
-        if ((err = alGetError()) != AL_NO_ERROR) {
+        err = bufferDataF32(bufId, samples, sampleCount, stereo, freq,
+                            _convBuf);
+        if (err != AL_NO_ERROR) {
             fprintf(stderr, "ERROR: alBufferData %d", err);
             return 0;
         }
@@ -180,20 +408,88 @@ void aud_freeBuffers(int count, uint32_t* ids)
 }
 
 
+/*
+  Return the output clock in frames at the device sample rate.
+  The clock starts at zero when aud_startup() is called.  Without the
+  ALC_SOFT_device_clock extension this is derived from the system clock and
+  will drift from the device.
+*/
+uint64_t aud_clock()
+{
+    if (_deviceClock) {
+        int64_t ns = 0;
+        _deviceClock(_adevice, ALC_DEVICE_CLOCK_SOFT, 1, &ns);
+        return (uint64_t) (ns / 1000000000) * _deviceFreq +
+               (uint64_t) (ns % 1000000000) * _deviceFreq / 1000000000;
+    }
+    return (uint64_t) ((timeNow() - _startTime) * _deviceFreq);
+}
+
+
+static int startWorker();
+
+/*
+  Start a source at the given output clock frame.  If the device does
+  not support AL_SOFT_source_start_delay then stream sources are delayed
+  with silence and buffer sources are started by the worker thread, so the
+  start is not exact (see aud_exactTiming()).
+  The caller must hold _streamMutex.
+*/
+static void playAt(ALuint src, uint64_t frame, int fxIndex)
+{
+    if (frame) {
+        if (_playAtTime) {
+            int64_t ns = (int64_t) (frame / _deviceFreq) * 1000000000 +
+                         (int64_t) (frame % _deviceFreq) * 1000000000 /
+                         _deviceFreq;
+            _playAtTime(src, ns);
+            return;
+        }
+        if (fxIndex >= 0 && frame > aud_clock() && startWorker()) {
+            _scheduled[fxIndex].frame = frame;
+            _scheduled[fxIndex].pending = 1;
+            return;
+        }
+    }
+    alSourcePlay(src);
+}
+
+
 /*
   \return source Id.
 */
 uint32_t aud_playSound(uint32_t bufferId)
+{
+    return aud_playSoundAt(bufferId, 0);
+}
+
+
+/*
+  Play a buffer starting at a given time.
+
+  \param frame  Output clock time (see aud_clock()) to start playing.
+                If the time has already passed the sound plays immediately.
+                The start is only sample accurate if aud_exactTiming()
+                returns non-zero.
+
+  \return source Id.
+*/
+uint32_t aud_playSoundAt(uint32_t bufferId, uint64_t frame)
 {
     static int sn = 0;
     if (bufferId && _audioUp) {
+        int fx = sn;
         ALuint src = _asource[ sn ];
         ++sn;
         if (sn == FX_COUNT)
             sn = 0;
 
+        pthread_mutex_lock(&_streamMutex);
+        _scheduled[fx].pending = 0;
+        alSourceStop(src);
         alSourcei(src, AL_BUFFER, bufferId);
-        alSourcePlay(src);
+        playAt(src, frame, fx);
+        pthread_mutex_unlock(&_streamMutex);
         return src;
     }
     return 0;
@@ -203,8 +499,15 @@ uint32_t aud_playSound(uint32_t bufferId)
 void aud_stopSound(uint32_t sourceId)
 {
     if (_audioUp) {
+        int i;
+        pthread_mutex_lock(&_streamMutex);
+        for (i = 0; i < FX_COUNT; ++i) {
+            if (_asource[i] == sourceId)
+                _scheduled[i].pending = 0;
+        }
         alSourceStop(sourceId);
         alSourcei(sourceId, AL_BUFFER, 0);
+        pthread_mutex_unlock(&_streamMutex);
     }
 }
 
@@ -219,4 +522,252 @@ void aud_setSoundVolume(float vol)
 }
 
 
+//----------------------------------------------------------------------------
+// Streaming sources
+//
+// A stream source has a small ring of buffers which are refilled by a worker
+// thread as they are played.  The stream variables are guarded by
+// _streamMutex.
+
+
+static void sleepMs(int ms)
+{
+#ifdef _WIN32
+    Sleep(ms);
+#else
+    struct timespec ts;
+    ts.tv_sec  = 0;
+    ts.tv_nsec = ms * 1000000;
+    nanosleep(&ts, NULL);
+#endif
+}
+
+
+/*
+  Fill and queue one stream buffer.
+  Return zero if the fill function has reached the end of the stream.
+*/
+static int stream_fill(AudioStream* st, ALuint buf)
+{
+    int channels = st->stereo ? 2 : 1;
+    int frames = 0;
+
+    if (st->delay) {
+        frames = (st->delay < STREAM_FRAMES) ? st->delay : STREAM_FRAMES;
+        memset(_streamBlock, 0, frames * channels * sizeof(float));
+        st->delay -= frames;
+    }
+    if (frames < STREAM_FRAMES)
+        frames += st->func(st->user, _streamBlock + frames * channels,
+                           STREAM_FRAMES - frames);
+
+    if (frames > 0) {
+        bufferDataF32(buf, _streamBlock, frames * channels, st->stereo,
+                      st->freq, _streamPcm);
+        alSourceQueueBuffers(st->source, 1, &buf);
+    }
+    return frames == STREAM_FRAMES;
+}
+
+
+static void stream_release(AudioStream* st)
+{
+    alSourceStop(st->source);
+    alSourcei(st->source, AL_BUFFER, 0);
+    st->state = STREAM_IDLE;
+}
+
+
+static void stream_service(AudioStream* st)
+{
+    ALuint buf;
+    ALint processed, queued, state;
+
+    alGetSourcei(st->source, AL_BUFFERS_PROCESSED, &processed);
+    while (processed > 0) {
+        --processed;
+        alSourceUnqueueBuffers(st->source, 1, &buf);
+        if (st->state == STREAM_PLAYING && ! stream_fill(st, buf))
+            st->state = STREAM_DRAINING;
+    }
+
+    while (st->state == STREAM_PLAYING && st->primed < STREAM_BUFFERS) {
+        if (! stream_fill(st, st->buf[ st->primed++ ]))
+            st->state = STREAM_DRAINING;
+    }
+
+    alGetSourcei(st->source, AL_SOURCE_STATE, &state);
+    if (state != AL_PLAYING) {
+        alGetSourcei(st->source, AL_BUFFERS_QUEUED, &queued);
+        if (queued > 0) {
+            // The source ran dry before the worker refilled it.
+            ++st->underruns;
+            alSourcePlay(st->source);
+        } else
+            stream_release(st);
+    }
+}
+
+
+static void* stream_thread(void* arg)
+{
+    uint64_t now;
+    int i;
+    (void) arg;
+
+    while (! _streamQuit) {
+        pthread_mutex_lock(&_streamMutex);
+        for (i = 0; i < STREAM_COUNT; ++i) {
+            if (_stream[i].state != STREAM_IDLE)
+                stream_service(_stream + i);
+        }
+
+        now = aud_clock();
+        for (i = 0; i < FX_COUNT; ++i) {
+            if (_scheduled[i].pending && _scheduled[i].frame <= now) {
+                _scheduled[i].pending = 0;
+                alSourcePlay(_asource[i]);
+            }
+        }
+        pthread_mutex_unlock(&_streamMutex);
+        sleepMs(STREAM_POLL_MS);
+    }
+    return NULL;
+}
+
+
+/*
+  Return non-zero if the worker thread is running.
+  This may be called with or without _streamMutex held, so a separate lock
+  ensures that only one thread is started.
+*/
+static int startWorker()
+{
+    int ok = 1;
+    pthread_mutex_lock(&_workerMutex);
+    if (_audioUp != AUDIO_THREAD_UP) {
+        if (pthread_create(&_streamThread, NULL, stream_thread, NULL) != 0)
+            ok = 0;
+        else
+            _audioUp = AUDIO_THREAD_UP;
+    }
+    pthread_mutex_unlock(&_workerMutex);
+    return ok;
+}
+
+
+/*
+  Begin playing a stream source.  The first buffer is filled before this
+  function returns and the rest are filled by a worker thread, which is
+  also where func will be called from afterwards.
+
+  \param func  Function to provide sample data.
+  \param user  User data passed to func.
+
+  \return Stream Id or zero if no stream is available.
+*/
+uint32_t aud_startStream(AudStreamFunc func, void* user, int stereo, int freq)
+{
+    return aud_startStreamAt(func, user, stereo, freq, 0);
+}
+
+
+/*
+  Begin playing a stream source at a given time.
+
+  \param frame  Output clock time (see aud_clock()) to start playing.
+                The start is only sample accurate if aud_exactTiming()
+                returns non-zero.
+
+  \return Stream Id or zero if no stream is available.
+*/
+uint32_t aud_startStreamAt(AudStreamFunc func, void* user, int stereo,
+                           int freq, uint64_t frame)
+{
+    AudioStream* st;
+    uint32_t id = 0;
+    uint64_t now;
+    int i;
+
+    if (! _audioUp || ! startWorker())
+        return 0;
+
+    pthread_mutex_lock(&_streamMutex);
+    for (i = 0; i < STREAM_COUNT; ++i) {
+        st = _stream + i;
+        if (st->state == STREAM_IDLE) {
+            st->func = func;
+            st->user = user;
+            st->stereo = stereo;
+            st->freq = freq;
+            st->underruns = 0;
+            st->delay = 0;
+            if (frame && ! _playAtTime) {
+                now = aud_clock();
+                if (frame > now)
+                    st->delay = (int) (frame - now);
+            }
+            st->primed = 1;
+            st->state = stream_fill(st, st->buf[0]) ? STREAM_PLAYING
+                                                    : STREAM_DRAINING;
+            playAt(st->source, frame, -1);
+            id = i + 1;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&_streamMutex);
+    return id;
+}
+
+
+void aud_stopStream(uint32_t streamId)
+{
+    if (streamId && streamId <= STREAM_COUNT && _audioUp) {
+        AudioStream* st = _stream + streamId - 1;
+        pthread_mutex_lock(&_streamMutex);
+        if (st->state != STREAM_IDLE)
+            stream_release(st);
+        pthread_mutex_unlock(&_streamMutex);
+    }
+}
+
+
+/*
+  Return non-zero if the stream is still playing.
+*/
+int aud_streamPlaying(uint32_t streamId)
+{
+    if (streamId && streamId <= STREAM_COUNT)
+        return _stream[ streamId - 1 ].state != STREAM_IDLE;
+    return 0;
+}
+
+
+/*
+  Return the number of times the stream has run out of queued data since
+  it was started.
+*/
+int aud_streamUnderruns(uint32_t streamId)
+{
+    if (streamId && streamId <= STREAM_COUNT)
+        return _stream[ streamId - 1 ].underruns;
+    return 0;
+}
+
+
+/*
+  Return non-zero if aud_playSoundAt() & aud_startStreamAt() begin sounds at
+  the exact frame requested.  This requires the ALC_SOFT_device_clock &
+  AL_SOFT_source_start_delay extensions.  Without them aud_clock() follows
+  the system clock; buffers are started by a worker polling every
+  STREAM_POLL_MS (5 ms), and streams are delayed with silence from the time
+  they are queued, so starts may be off by the poll interval plus the
+  device latency.
+*/
+int aud_exactTiming()
+{
+    return _playAtTime != 0;
+}
+
+
 //EOF
@@ -0,0 +1,179 @@
+/*
+ * Headless audio backend check
+ *
+ * Plays a buffer & a stream at scheduled times through audio_null.c with
+ * the clock advanced manually, then checks the operation timings and that
+ * each sound begins at the expected frame of the Wave output.
+ *
+ * Compile with:
+ *   cc -O2 test/audcheck.c support/audio_null.c -Isupport -lpthread -o audcheck
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "audio_null.h"
+
+#define EX_IOERR    74  /* input/output error */
+
+#define FREQ            44100
+#define BUF_FRAMES      1000
+#define BUF_LEVEL       0.25f
+#define BUF_START       1500        /* Not on a mix block boundary. */
+#define STREAM_FRAMES   3000
+#define STREAM_LEVEL    0.5f
+#define STREAM_START    5000
+#define REPLAY_START    10000       /* Buffer played again immediately. */
+#define TOTAL_FRAMES    12000
+
+#define WAV_HEADER      44
+
+static int streamLeft = STREAM_FRAMES;
+
+static int streamFill(void* user, float* samples, int frameCount)
+{
+    int i;
+    (void) user;
+    if (frameCount > streamLeft)
+        frameCount = streamLeft;
+    for (i = 0; i < frameCount; ++i)
+        samples[i] = STREAM_LEVEL;
+    streamLeft -= frameCount;
+    return frameCount;
+}
+
+/* Return the mix level expected at an output frame. */
+static float expectedLevel(int frame)
+{
+    float v = 0.0f;
+    if (frame >= BUF_START && frame < BUF_START + BUF_FRAMES)
+        v += BUF_LEVEL;
+    if (frame >= STREAM_START && frame < STREAM_START + STREAM_FRAMES)
+        v += STREAM_LEVEL;
+    if (frame >= REPLAY_START && frame < REPLAY_START + BUF_FRAMES)
+        v += BUF_LEVEL;
+    return v;
+}
+
+static int checkTiming(int id, const char* name, uint32_t calls,
+                       uint64_t samples)
+{
+    const AudioTiming* tm = aud_timing(id);
+    if (tm->calls != calls || tm->samples != samples) {
+        printf("%s timing: %u calls, %llu samples (expected %u, %llu)\n",
+               name, tm->calls, (unsigned long long) tm->samples,
+               calls, (unsigned long long) samples);
+        return 0;
+    }
+    return 1;
+}
+
+/*
+ * Check that the Wave file holds TOTAL_FRAMES stereo frames matching
+ * expectedLevel().
+ */
+static int checkWave(const char* file)
+{
+    int16_t* pcm;
+    uint32_t dataSize;
+    uint8_t header[WAV_HEADER];
+    int16_t want;
+    int i, ok = 1;
+    FILE* fp;
+
+    fp = fopen(file, "rb");
+    if (! fp) {
+        printf("Cannot open %s\n", file);
+        return 0;
+    }
+    pcm = (int16_t*) malloc(TOTAL_FRAMES * 4);
+    if (fread(header, 1, WAV_HEADER, fp) != WAV_HEADER) {
+        printf("Short Wave header\n");
+        ok = 0;
+        goto done;
+    }
+    memcpy(&dataSize, header + 40, 4);
+    if (dataSize != TOTAL_FRAMES * 4) {
+        printf("Wave data is %u bytes (expected %d)\n", dataSize,
+               TOTAL_FRAMES * 4);
+        ok = 0;
+        goto done;
+    }
+    if (fread(pcm, 4, TOTAL_FRAMES, fp) != TOTAL_FRAMES) {
+        printf("Short Wave data\n");
+        ok = 0;
+        goto done;
+    }
+
+    for (i = 0; i < TOTAL_FRAMES; ++i) {
+        want = (int16_t) (expectedLevel(i) * 32767.0f);
+        if (pcm[i*2] != want || pcm[i*2+1] != want) {
+            printf("Frame %d is %d,%d (expected %d)\n",
+                   i, pcm[i*2], pcm[i*2+1], want);
+            ok = 0;
+            break;
+        }
+    }
+
+done:
+    free(pcm);
+    fclose(fp);
+    return ok;
+}
+
+int main(int argc, char** argv)
+{
+    const char* file = (argc > 1) ? argv[1] : "audcheck.wav";
+    float samples[BUF_FRAMES];
+    uint32_t buf, streamId;
+    int i, ok = 1;
+
+    aud_configureHeadless(FREQ, 0.0, file);
+    if (! aud_startup()) {
+        printf("Cannot start audio (%s)\n", file);
+        return EX_IOERR;
+    }
+
+    if (! aud_exactTiming()) {
+        printf("Scheduling is not exact\n");
+        ok = 0;
+    }
+
+    for (i = 0; i < BUF_FRAMES; ++i)
+        samples[i] = BUF_LEVEL;
+    aud_genBuffers(1, &buf);
+    if (! aud_loadBufferF32(buf, samples, BUF_FRAMES, 0, FREQ)) {
+        printf("Buffer load failed\n");
+        ok = 0;
+    }
+
+    aud_playSoundAt(buf, BUF_START);
+    streamId = aud_startStreamAt(streamFill, NULL, 0, FREQ, STREAM_START);
+    aud_advance(REPLAY_START);
+    if (aud_clock() != REPLAY_START) {
+        printf("Clock is %llu (expected %d)\n",
+               (unsigned long long) aud_clock(), REPLAY_START);
+        ok = 0;
+    }
+    if (aud_streamPlaying(streamId)) {
+        printf("Stream still playing\n");
+        ok = 0;
+    }
+    aud_playSound(buf);
+    aud_advance(TOTAL_FRAMES - REPLAY_START);
+
+    /* The stream is filled in blocks of 1024 frames. */
+    ok &= checkTiming(AUD_TIMING_LOAD, "Load", 1, BUF_FRAMES);
+    ok &= checkTiming(AUD_TIMING_STREAM, "Stream",
+                      (STREAM_FRAMES + 1023) / 1024, STREAM_FRAMES);
+    ok &= checkTiming(AUD_TIMING_MIX, "Mix",
+                      aud_timing(AUD_TIMING_MIX)->calls, TOTAL_FRAMES);
+    ok &= checkTiming(AUD_TIMING_WRITE, "Write",
+                      aud_timing(AUD_TIMING_MIX)->calls, TOTAL_FRAMES);
+    aud_shutdown();
+
+    ok &= checkWave(file);
+    printf("Headless audio: %s\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
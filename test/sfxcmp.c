@@ -0,0 +1,460 @@
+/*
+ * sfx_gen regression comparison tool
+ *
+ * Compares Wave files against golden references using error tolerances
+ * rather than requiring bit-exact output, and generates the .rfx corpus
+ * used by test.sh.
+ *
+ * Compile with: cc -O2 test/sfxcmp.c -I. -Isupport -lm -o sfxcmp
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "sfx_gen.c"
+
+#define EX_USAGE    64  /* command line usage error */
+#define EX_IOERR    74  /* input/output error */
+
+int sfx_random(int range)
+{
+    return rand() % range;
+}
+
+//----------------------------------------------------------------------------
+// Corpus
+
+static const char* waveNames[] = {
+    "square", "sawtooth", "sine", "noise", "triangle", "pinkNoise"
+};
+
+// Names of the float members of SfxParams, starting at attackTime.
+static const char* paramNames[] = {
+    "attack", "sustain", "punch", "decay",
+    "freq", "minFreq", "slide", "deltaSlide", "vibDepth", "vibSpeed",
+    "changeAmount", "changeSpeed",
+    "duty", "dutySweep",
+    "repeat",
+    "phaserOffset", "phaserSweep",
+    "lpf", "lpfSweep", "lpfRes", "hpf", "hpfSweep"
+};
+
+#define FLOAT_PARAMS    22
+
+// Reset params to the default of a wave type with a fixed seed.
+static void resetCorpusParams(SfxParams* sp, int wave, uint32_t seed)
+{
+    sfx_resetParams(sp);
+    sp->waveType = wave;
+    sp->randSeed = seed;
+}
+
+static int saveCorpusFile(const SfxParams* sp, const char* dir,
+                          const char* name)
+{
+    char path[512];
+    const char* err;
+
+    snprintf(path, sizeof(path), "%s/%s.rfx", dir, name);
+    err = sfx_saveRfx(sp, path);
+    if (err) {
+        fprintf(stderr, "ERROR: %s (%s)\n", err, path);
+        return 0;
+    }
+    return 1;
+}
+
+/*
+ * Write the .rfx files of every wave type with the default parameters,
+ * with each parameter individually set to its extremes, and with all
+ * parameters at their lows & highs.
+ *
+ * Return number of files written or -1 if an error occurred.
+ */
+static int generateCorpus(const char* dir)
+{
+    SfxParams sp;
+    float* val = &sp.attackTime;
+    char name[80];
+    uint32_t seed = 1;
+    int w, i, n = 0;
+
+    for (w = 0; w <= SFX_PINK_NOISE; ++w) {
+        resetCorpusParams(&sp, w, seed++);
+        if (! saveCorpusFile(&sp, dir, waveNames[w]))
+            return -1;
+        ++n;
+
+        for (i = 0; i < FLOAT_PARAMS; ++i) {
+            resetCorpusParams(&sp, w, seed++);
+            val[i] = (SFX_NEGATIVE_ONE_MASK & (1 << i)) ? -1.0f : 0.0f;
+            snprintf(name, sizeof(name), "%s_%s_lo", waveNames[w],
+                     paramNames[i]);
+            if (! saveCorpusFile(&sp, dir, name))
+                return -1;
+
+            resetCorpusParams(&sp, w, seed++);
+            val[i] = 1.0f;
+            snprintf(name, sizeof(name), "%s_%s_hi", waveNames[w],
+                     paramNames[i]);
+            if (! saveCorpusFile(&sp, dir, name))
+                return -1;
+            n += 2;
+        }
+
+        resetCorpusParams(&sp, w, seed++);
+        for (i = 0; i < FLOAT_PARAMS; ++i)
+            val[i] = (SFX_NEGATIVE_ONE_MASK & (1 << i)) ? -1.0f : 0.0f;
+        snprintf(name, sizeof(name), "%s_all_lo", waveNames[w]);
+        if (! saveCorpusFile(&sp, dir, name))
+            return -1;
+
+        resetCorpusParams(&sp, w, seed++);
+        for (i = 0; i < FLOAT_PARAMS; ++i)
+            val[i] = 1.0f;
+        snprintf(name, sizeof(name), "%s_all_hi", waveNames[w]);
+        if (! saveCorpusFile(&sp, dir, name))
+            return -1;
+        n += 2;
+    }
+    return n;
+}
+
+//----------------------------------------------------------------------------
+// Block rendering
+
+static int renderWhole(SfxSynth* synth, const SfxParams* sp)
+{
+    srand(sp->randSeed);
+    sfx_startWave(synth, sp);
+    return sfx_generateBlock(synth, synth->samples.f,
+                             synth->sampleRate * synth->maxDuration);
+}
+
+static int renderBlocks(SfxSynth* synth, const SfxParams* sp, int blockSize)
+{
+    int limit = synth->sampleRate * synth->maxDuration;
+    int total = 0, n;
+
+    srand(sp->randSeed);
+    sfx_startWave(synth, sp);
+    do {
+        if (blockSize > limit - total)
+            blockSize = limit - total;
+        n = sfx_generateBlock(synth, synth->samples.f + total, blockSize);
+        total += n;
+    } while (n == blockSize && total < limit);
+    return total;
+}
+
+/*
+ * Check that rendering each .rfx file in blocks of blockSize samples gives
+ * exactly the same samples as a single sfx_generateBlock() call.
+ *
+ * Return number of files which differ or -1 if an error occurred.
+ */
+static int checkBlocks(char** files, int count, int blockSize,
+                       int controlRate, int verbose)
+{
+    SfxSynth* whole = sfx_allocSynth(SFX_F32, 44100, 10);
+    SfxSynth* block = sfx_allocSynth(SFX_F32, 44100, 10);
+    SfxParams sp;
+    const char* err;
+    int i, n, nb, failed = 0;
+
+    whole->controlRate = block->controlRate = controlRate;
+    for (i = 0; i < count; ++i) {
+        err = sfx_loadParams(&sp, files[i], NULL);
+        if (err) {
+            fprintf(stderr, "ERROR: %s (%s)\n", err, files[i]);
+            failed = -1;
+            break;
+        }
+        n  = renderWhole(whole, &sp);
+        nb = renderBlocks(block, &sp, blockSize);
+        if (n != nb || memcmp(whole->samples.f, block->samples.f,
+                              sizeof(float) * n)) {
+            printf("%s: FAILED  len %d  blocks len %d\n", files[i], n, nb);
+            ++failed;
+        } else if (verbose)
+            printf("%s: OK\n", files[i]);
+    }
+    if (failed >= 0)
+        printf("%d of %d files match in blocks of %d\n", count - failed,
+               count, blockSize);
+
+    free(whole);
+    free(block);
+    return failed;
+}
+
+//----------------------------------------------------------------------------
+// Comparison
+
+typedef struct {
+    float* samples;
+    int count;
+    int sampleRate;
+} Wave;
+
+static uint32_t readU32(const uint8_t* p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static uint16_t readU16(const uint8_t* p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+/*
+ * Load a mono 8 or 16-bit PCM or 32-bit float Wave file as floats.
+ * Return error message or NULL if successful.
+ */
+static const char* loadWave(Wave* wav, const char* file)
+{
+    uint8_t head[16];
+    uint8_t* data = NULL;
+    uint32_t size;
+    int format = 0, bits = 0, channels = 0;
+    int i;
+    const char* err = "Invalid Wave file";
+    FILE* fp = fopen(file, "rb");
+
+    wav->samples = NULL;
+    wav->count = 0;
+    if (! fp)
+        return "File open failed";
+
+    if (fread(head, 1, 12, fp) != 12 || memcmp(head, "RIFF", 4) ||
+        memcmp(head + 8, "WAVE", 4))
+        goto cleanup;
+
+    while (fread(head, 1, 8, fp) == 8) {
+        size = readU32(head + 4);
+        if (memcmp(head, "fmt ", 4) == 0) {
+            if (size < 16 || fread(head, 1, 16, fp) != 16)
+                goto cleanup;
+            format   = readU16(head);
+            channels = readU16(head + 2);
+            wav->sampleRate = readU32(head + 4);
+            bits     = readU16(head + 14);
+            fseek(fp, (size - 16 + 1) & ~1, SEEK_CUR);
+        } else if (memcmp(head, "data", 4) == 0) {
+            if (channels != 1) {
+                err = "Only mono Wave files are supported";
+                goto cleanup;
+            }
+            if (! ((format == 1 && (bits == 8 || bits == 16)) ||
+                   (format == 3 && bits == 32))) {
+                err = "Unsupported sample format";
+                goto cleanup;
+            }
+            data = (uint8_t*) malloc(size);
+            if (! data || fread(data, 1, size, fp) != size) {
+                err = "File read failed";
+                goto cleanup;
+            }
+            wav->count = size / (bits / 8);
+            wav->samples = (float*) malloc(sizeof(float) * (wav->count + 1));
+            for (i = 0; i < wav->count; ++i) {
+                if (bits == 8)
+                    wav->samples[i] = (data[i] - 128) / 127.0f;
+                else if (bits == 16)
+                    wav->samples[i] =
+                        (int16_t) readU16(data + i*2) / 32767.0f;
+                else
+                    memcpy(wav->samples + i, data + i*4, 4);
+            }
+            err = NULL;
+            break;
+        } else
+            fseek(fp, (size + 1) & ~1, SEEK_CUR);
+    }
+
+cleanup:
+    free(data);
+    fclose(fp);
+    return err;
+}
+
+typedef struct {
+    double maxAbs;      // Largest absolute sample difference
+    double rms;         // Root mean square of the difference
+    double snr;         // Signal to error ratio in dB
+    int lengthDiff;     // Test length - reference length
+} Metrics;
+
+typedef struct {
+    double maxAbs;
+    double rms;
+    double snr;
+    int length;         // Allowed length difference in samples
+} Tolerance;
+
+/*
+ * Compare test against ref.  Samples past the end of the shorter wave are
+ * compared against silence.
+ */
+static void compareWaves(const Wave* ref, const Wave* test, Metrics* m)
+{
+    double signal = 0.0, noise = 0.0, d, r, t;
+    int count = (ref->count > test->count) ? ref->count : test->count;
+    int i;
+
+    m->maxAbs = 0.0;
+    for (i = 0; i < count; ++i) {
+        r = (i < ref->count)  ? ref->samples[i]  : 0.0;
+        t = (i < test->count) ? test->samples[i] : 0.0;
+        d = fabs(t - r);
+        if (m->maxAbs < d)
+            m->maxAbs = d;
+        signal += r * r;
+        noise  += d * d;
+    }
+
+    m->rms = count ? sqrt(noise / count) : 0.0;
+    if (noise == 0.0)
+        m->snr = INFINITY;
+    else if (signal == 0.0)
+        m->snr = -INFINITY;
+    else
+        m->snr = 10.0 * log10(signal / noise);
+    m->lengthDiff = test->count - ref->count;
+}
+
+static int withinTolerance(const Metrics* m, const Tolerance* tol)
+{
+    return m->maxAbs <= tol->maxAbs && m->rms <= tol->rms &&
+           m->snr >= tol->snr && abs(m->lengthDiff) <= tol->length;
+}
+
+// Return pointer to the file name part of a path.
+static const char* baseName(const char* path)
+{
+    const char* sep = strrchr(path, '/');
+    return sep ? sep + 1 : path;
+}
+
+static const char* usage =
+    "Usage: sfxcmp [<options>] -d <ref-dir> <wave-file> ...\n"
+    "       sfxcmp [<options>] <ref-wave> <wave-file>\n"
+    "       sfxcmp -g <dir>\n"
+    "       sfxcmp [-v] [-c <count>] -b <count> <rfx-file> ...\n"
+    "\n"
+    "Options:\n"
+    "  -a <error>   Maximum absolute sample error (default 0.002).\n"
+    "  -b <count>   Check that rendering in blocks of count samples matches\n"
+    "               a whole render.\n"
+    "  -c <count>   Set the synth controlRate for -b (default 0).\n"
+    "  -d <dir>     Compare each file with the one of the same name in dir.\n"
+    "  -g <dir>     Write the test corpus .rfx files to dir and quit.\n"
+    "  -h           Print this help and quit.\n"
+    "  -l <count>   Allowed length difference in samples (default 0).\n"
+    "  -r <error>   Maximum RMS error (default 0.0005).\n"
+    "  -s <dB>      Minimum signal to error ratio (default 60).\n"
+    "  -v           Report files which pass as well as failures.\n";
+
+int main(int argc, char** argv)
+{
+    Tolerance tol;
+    Metrics m;
+    Wave ref, test;
+    const char* refDir = NULL;
+    const char* refFile;
+    const char* err;
+    char path[512];
+    int verbose = 0;
+    int blockSize = 0;
+    int controlRate = 0;
+    int files = 0, failed = 0, pass;
+    int i, first;
+
+    tol.maxAbs = 0.002;
+    tol.rms    = 0.0005;
+    tol.snr    = 60.0;
+    tol.length = 0;
+
+    for (i = 1; i < argc && argv[i][0] == '-'; ++i) {
+        int opt = argv[i][1];
+        if (opt == 'h') {
+            fputs(usage, stdout);
+            return 0;
+        }
+        if (opt == 'v') {
+            verbose = 1;
+            continue;
+        }
+        if (i+1 >= argc)
+            goto bad_usage;
+        switch (opt) {
+            case 'a': tol.maxAbs = atof(argv[++i]); break;
+            case 'b': blockSize = atoi(argv[++i]); break;
+            case 'c': controlRate = atoi(argv[++i]); break;
+            case 'd': refDir = argv[++i]; break;
+            case 'l': tol.length = atoi(argv[++i]); break;
+            case 'r': tol.rms = atof(argv[++i]); break;
+            case 's': tol.snr = atof(argv[++i]); break;
+            case 'g': {
+                int n = generateCorpus(argv[i+1]);
+                if (n < 0)
+                    return EX_IOERR;
+                printf("Wrote %d files to %s\n", n, argv[i+1]);
+                return 0;
+            }
+            default:
+                goto bad_usage;
+        }
+    }
+
+    first = i;
+    if (blockSize > 0 && first < argc) {
+        failed = checkBlocks(argv + first, argc - first, blockSize,
+                             controlRate, verbose);
+        return (failed < 0) ? EX_IOERR : (failed ? 1 : 0);
+    }
+    if (first >= argc || (! refDir && argc - first != 2))
+        goto bad_usage;
+
+    for (i = first; i < argc; ++i) {
+        if (refDir) {
+            snprintf(path, sizeof(path), "%s/%s", refDir, baseName(argv[i]));
+            refFile = path;
+        } else
+            refFile = argv[i++];
+
+        err = loadWave(&ref, refFile);
+        if (err) {
+            fprintf(stderr, "ERROR: %s (%s)\n", err, refFile);
+            return EX_IOERR;
+        }
+        err = loadWave(&test, argv[i]);
+        if (err) {
+            fprintf(stderr, "ERROR: %s (%s)\n", err, argv[i]);
+            free(ref.samples);
+            return EX_IOERR;
+        }
+
+        compareWaves(&ref, &test, &m);
+        pass = withinTolerance(&m, &tol);
+        if (! pass || verbose)
+            printf("%s: %s  len %+d  max %.6f  rms %.6f  snr %.1f dB\n",
+                   argv[i], pass ? "OK" : "FAILED", m.lengthDiff,
+                   m.maxAbs, m.rms, m.snr);
+        ++files;
+        if (! pass)
+            ++failed;
+
+        free(ref.samples);
+        free(test.samples);
+    }
+
+    printf("%d of %d files within tolerance\n", files - failed, files);
+    return failed ? 1 : 0;
+
+bad_usage:
+    fputs(usage, stderr);
+    return EX_USAGE;
+}
@@ -1,7 +1,47 @@
 # sfxgen regression test
+#
+# With no argument the output of the .rfx files here must match wav.sha1.
+#
+#   update      Store the sha1 sums of the current output in wav.sha1.
+#   golden      Render the generated corpus into golden/ as the reference.
+#   compare     Render the corpus into corpus/ and check it against golden/
+#               using the sfxcmp tolerances (any further arguments are
+#               passed to sfxcmp).
+#   fast        Render the corpus with and without the sfxgen control rate
+#               option (-c 32) and compare the two.
+#   blocks      Check that rendering the corpus in blocks gives the same
+#               samples as a whole render, with and without a control rate.
+#   audio       Play a buffer & a stream through the headless audio backend
+#               (audcheck) and check the start frames of its Wave output.
 
 if [ "$1" = "update" ]; then
 	sha1sum *.wav >wav.sha1
+elif [ "$1" = "golden" ]; then
+	rm -rf golden; mkdir golden
+	../sfxcmp -g golden && cp *.rfx golden/ && ../sfxgen golden/*.rfx
+elif [ "$1" = "compare" ]; then
+	shift
+	if [ ! -d golden ]; then
+		echo "No golden/ references; run 'test.sh golden' with a reference build"
+		exit 1
+	fi
+	rm -rf corpus; mkdir corpus
+	../sfxcmp -g corpus >/dev/null && cp *.rfx corpus/ &&
+	../sfxgen corpus/*.rfx && ../sfxcmp "$@" -d golden corpus/*.wav
+elif [ "$1" = "fast" ]; then
+	shift
+	rm -rf corpus; mkdir -p corpus/ref corpus/fast
+	../sfxcmp -g corpus/ref >/dev/null && cp *.rfx corpus/ref/ &&
+	cp corpus/ref/*.rfx corpus/fast/ &&
+	../sfxgen corpus/ref/*.rfx && ../sfxgen -c 32 corpus/fast/*.rfx &&
+	../sfxcmp "$@" -d corpus/ref corpus/fast/*.wav
+elif [ "$1" = "blocks" ]; then
+	rm -rf corpus; mkdir corpus
+	../sfxcmp -g corpus >/dev/null && cp *.rfx corpus/ &&
+	../sfxcmp -b 4096 corpus/*.rfx && ../sfxcmp -b 1000 -c 32 corpus/*.rfx
+elif [ "$1" = "audio" ]; then
+	rm -rf corpus; mkdir corpus
+	../audcheck corpus/audcheck.wav
 else
 	../sfxgen *.rfx
 	sha1sum -c wav.sha1